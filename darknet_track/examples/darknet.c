@@ -206,6 +206,28 @@ void rescale_net(char *cfgfile, char *weightfile, char *outfile)
     save_weights(net, outfile);
 }
 
+/** rewrites a .weights file with fp16 convolution weights, for half=1 deployments */
+void half_net(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network net = parse_network_cfg(cfgfile);
+    if(weightfile){
+        load_weights(&net, weightfile);
+    }
+    save_weights_half(net, outfile);
+}
+
+/** rewrites a .weights file as a weights map, which per-camera processes mmap() and share */
+void map_net(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network net = parse_network_cfg(cfgfile);
+    if(weightfile){
+        load_weights(&net, weightfile);
+    }
+    save_weights_mapped(net, outfile);
+}
+
 void rgbgr_net(char *cfgfile, char *weightfile, char *outfile)
 {
     gpu_index = -1;
@@ -478,6 +500,10 @@ int main(int argc, char **argv)
         run_captcha(argc, argv);
     } else if (0 == strcmp(argv[1], "nightmare")){
         run_nightmare(argc, argv);
+    } else if (0 == strcmp(argv[1], "half")){
+        half_net(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "map")){
+        map_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "rgbgr")){
         rgbgr_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "reset")){
@@ -576,6 +576,52 @@ void validate_detector_recall(char *cfgfile, char *weightfile)
     }
 }
 
+/**
+ * Runs up to n validation images through the fp32 network and records the largest |input| each
+ * convolution sees, for int8=1 inference. The first layer and the linear detection head stay in
+ * fp32: they are where the quantization error costs the most boxes.
+ */
+void calibrate_detector(char *datacfg, char *cfgfile, char *weightfile, int n)
+{
+    int i, j, k;
+    char buff[256];
+    list *options = read_data_cfg(datacfg);
+    char *valid_images = option_find_str(options, "valid", "data/train.list");
+
+    network net = parse_network_cfg(cfgfile);
+    net.int8 = 0;
+    if(weightfile){
+        load_weights(&net, weightfile);
+    }
+    set_batch_network(&net, 1);
+
+    list *plist = get_paths(valid_images);
+    char **paths = (char **)list_to_array(plist);
+    float *ranges = calloc(net.n, sizeof(float));
+    int m = (n && n < plist->size) ? n : plist->size;
+
+    for(i = 0; i < m; ++i){
+        image im = load_image_color(paths[i], 0, 0);
+        image sized = letterbox_image(im, net.w, net.h);
+        network_predict(net, sized.data);
+        for(j = 1; j < net.n; ++j){
+            layer l = net.layers[j];
+            layer prev = net.layers[j-1];
+            if(l.type != CONVOLUTIONAL || l.activation == LINEAR) continue;
+            for(k = 0; k < prev.outputs; ++k){
+                float v = (prev.output[k] < 0) ? -prev.output[k] : prev.output[k];
+                if(v > ranges[j]) ranges[j] = v;
+            }
+        }
+        if(i % 10 == 0) fprintf(stderr, "%d/%d\n", i, m);
+        free_image(im);
+        free_image(sized);
+    }
+    sprintf(buff, "%s.qtable", weightfile ? weightfile : basecfg(cfgfile));
+    save_quantization_table(net, ranges, buff);
+    free(ranges);
+}
+
 void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, char *outfile, int fullscreen)
 {
     list *options = read_data_cfg(datacfg);
@@ -588,6 +634,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
         load_weights(&net, weightfile);
     }
     set_batch_network(&net, 1);
+    finalize_network_for_inference(&net);
     srand(2222222);
     clock_t time;
     char buff[256];
@@ -657,7 +704,7 @@ void run_detector(int argc, char **argv)
     int frame_skip = find_int_arg(argc, argv, "-s", 0);
     int avg = find_int_arg(argc, argv, "-avg", 3);
     if(argc < 4){
-        fprintf(stderr, "usage: %s %s [train/test/valid] [cfg] [weights (optional)]\n", argv[0], argv[1]);
+        fprintf(stderr, "usage: %s %s [train/test/valid/calibrate] [cfg] [weights (optional)]\n", argv[0], argv[1]);
         return;
     }
     char *gpu_list = find_char_arg(argc, argv, "-gpus", 0);
@@ -689,6 +736,7 @@ void run_detector(int argc, char **argv)
     int width = find_int_arg(argc, argv, "-w", 0);
     int height = find_int_arg(argc, argv, "-h", 0);
     int fps = find_int_arg(argc, argv, "-fps", 0);
+    int calibration_images = find_int_arg(argc, argv, "-n", 0);
 
     char *datacfg = argv[3];
     char *cfg = argv[4];
@@ -699,6 +747,7 @@ void run_detector(int argc, char **argv)
     else if(0==strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "valid2")) validate_detector_flip(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "recall")) validate_detector_recall(cfg, weights);
+    else if(0==strcmp(argv[2], "calibrate")) calibrate_detector(datacfg, cfg, weights, calibration_images);
     else if(0==strcmp(argv[2], "demo")) {
         list *options = read_data_cfg(datacfg);
         int classes = option_find_int(options, "classes", 20);
@@ -143,6 +143,10 @@ struct layer{
     int index;
     int binary;
     int xnor;
+    int winograd;
+    int nhwc;
+    int fused;
+    int borrowed_output;
     int steps;
     int hidden;
     int truth;
@@ -219,6 +223,14 @@ struct layer{
 
     float * weights;
     float * weight_updates;
+    int mapped_weights;
+    float * winograd_weights;
+    unsigned short * weights_half;
+    float qinput_range;
+    float qinput_scale;
+    signed char * qweights;
+    int * qweight_sums;
+    float * qscales;
 
     float * delta;
     float * output;
@@ -269,6 +281,7 @@ struct layer{
 
     float * binary_input;
 
+    struct layer *fused_maxpool;
     struct layer *input_layer;
     struct layer *self_layer;
     struct layer *output_layer;
@@ -459,6 +472,13 @@ typedef struct network{
     float *delta;
     float *workspace;
     int train;
+    int int8;
+    int half;
+    int nhwc;
+    float *layout_buffer;
+    void *weights_map;
+    size_t weights_map_size;
+    float *output_arena;
     int index;
     float *cost;
 
@@ -636,10 +656,16 @@ char *option_find_str(list *l, char *key, char *def);
 int option_find_int(list *l, char *key, int def);
 
 network parse_network_cfg(char *filename);
+network parse_network_cfg_mapped(char *filename, char *weights);
+int is_weights_map(char *filename);
 void save_weights(network net, char *filename);
 void load_weights(network *net, char *filename);
 void save_weights_upto(network net, char *filename, int cutoff);
+void save_weights_half(network net, char *filename);
+void save_weights_mapped(network net, char *filename);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
+void load_quantization_table(network *net, char *filename);
+void save_quantization_table(network net, float *ranges, char *filename);
 
 void zero_objectness(layer l);
 void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, float **probs, box *boxes, int only_objectness, int *map, float tree_thresh, int relative);
@@ -655,6 +681,8 @@ image resize_min(image im, int min);
 image threshold_image(image im, float thresh);
 image mask_to_rgb(image mask);
 int resize_network(network *net, int w, int h);
+void shrink_workspace_for_inference(network *net);
+void finalize_network_for_inference(network *net);
 void free_matrix(matrix m);
 void test_resize(char *filename);
 void save_image(image p, const char *name);
@@ -9,7 +9,7 @@ struct AnnInfo
      int y;
      int w;
      int h;
-     char* pcClassName;
+     char* pcClassName; /**< borrowed from the detector's names table (index nClassId); never freed with the BB */
      double fCurrentFrameTimeStamp;
      int nVideoId;
      double prob;
@@ -21,6 +21,7 @@ struct AnnInfo
      int nLaneId; /**< currently darknet fetch the ROI polygons when you start and use them to track new BBs */
      int nLaneHistory;
      double fStartTS;
+     char bPooled; /**< node lives in its frame's BB pool and is released with the frame */
      tAnnInfo* pNext;
 };
 
@@ -49,9 +50,19 @@ typedef struct
     int isVideo;
     int nFrameId;
     char* pcNames;
+    int nBBAssocAlgo; /**< tBBAssocAlgo in multitracker.h; 0 selects the greedy match */
+    int nProcWidth; /**< decode / process frames at this size; 0 follows nProcHeight at the video's aspect, both 0 keep the video's size */
+    int nProcHeight;
+    char* pcLanes; /**< lanes file of this video; NULL for lanes.json. Must differ between the streams of run_detector_models() */
 }tDetectorModel;
 
 int run_detector_model(tDetectorModel* apDetectorModel);
+/**
+ * runs nModels videos through one network: each forward pass is a batch of one frame per stream
+ * all streams use apDetectorModels[0]'s cfg and weights; nVideoId must be unique per stream
+ * @return 0 if success, else 1
+ */
+int run_detector_models(tDetectorModel** apDetectorModels, int nModels);
 
 inline void free_BBs(tAnnInfo* pBBs)
 {
@@ -60,9 +71,8 @@ inline void free_BBs(tAnnInfo* pBBs)
     while((pBBToDelete = pBB))
     {
         pBB = pBB->pNext;
-        if(pBBToDelete->pcClassName)
-            free(pBBToDelete->pcClassName);
-        free(pBBToDelete);
+        if(!pBBToDelete->bPooled)
+            free(pBBToDelete);
     }
 }
 
@@ -71,8 +81,7 @@ inline tAnnInfo* copyBB(tAnnInfo* pBB)
     tAnnInfo* pBBN = (tAnnInfo*)malloc(sizeof(tAnnInfo));
 
     memcpy(pBBN, pBB, sizeof(tAnnInfo));
-    pBBN->pcClassName = (char*)malloc(strlen(pBB->pcClassName) + 1);
-    strcpy(pBBN->pcClassName, pBB->pcClassName);
+    pBBN->bPooled = 0;
     pBBN->pNext = NULL;
 
     return pBBN;
@@ -107,6 +116,68 @@ inline tAnnInfo* getBBById(tAnnInfo* pBBs, int nBBId)
     return NULL;
 }
 
+/** contiguous struct-of-arrays copy of a BB list for tight per-box loops (IoU etc.);
+ * all the arrays live in one allocation which is kept and reused,
+ * so refilling the set every frame does not allocate in steady state */
+typedef struct
+{
+    int n;
+    int nCap;
+    int* x;
+    int* y;
+    int* w;
+    int* h;
+    int* nClassId; /**< index into the detector's names table */
+    int* nBBId;
+    float* prob;
+    tAnnInfo** ppBB; /**< the list node entry i was filled from */
+    void* pArena;
+}tBBSet;
+
+static inline void bbset_reserve(tBBSet* pSet, int nCap)
+{
+    char* p;
+    if(nCap <= pSet->nCap)
+        return;
+    free(pSet->pArena);
+    /** pointers first to keep every array naturally aligned */
+    p = (char*)malloc((size_t)nCap * (sizeof(tAnnInfo*) + 6 * sizeof(int) + sizeof(float)));
+    pSet->pArena = p;
+    pSet->ppBB = (tAnnInfo**)p;      p += (size_t)nCap * sizeof(tAnnInfo*);
+    pSet->x = (int*)p;               p += (size_t)nCap * sizeof(int);
+    pSet->y = (int*)p;               p += (size_t)nCap * sizeof(int);
+    pSet->w = (int*)p;               p += (size_t)nCap * sizeof(int);
+    pSet->h = (int*)p;               p += (size_t)nCap * sizeof(int);
+    pSet->nClassId = (int*)p;        p += (size_t)nCap * sizeof(int);
+    pSet->nBBId = (int*)p;           p += (size_t)nCap * sizeof(int);
+    pSet->prob = (float*)p;
+    pSet->nCap = nCap;
+}
+
+static inline void bbset_from_list(tBBSet* pSet, tAnnInfo* pBBs)
+{
+    int n = 0;
+    tAnnInfo* pBB;
+    for(pBB = pBBs; pBB; pBB = pBB->pNext)
+        n++;
+    /** grow geometrically so a slowly growing scene does not realloc every frame */
+    if(n > pSet->nCap)
+        bbset_reserve(pSet, n > 2 * pSet->nCap ? n : 2 * pSet->nCap);
+    pSet->n = 0;
+    for(pBB = pBBs; pBB; pBB = pBB->pNext)
+    {
+        int i = pSet->n++;
+        pSet->ppBB[i] = pBB;
+        pSet->x[i] = pBB->x;
+        pSet->y[i] = pBB->y;
+        pSet->w[i] = pBB->w;
+        pSet->h[i] = pBB->h;
+        pSet->nClassId[i] = pBB->nClassId;
+        pSet->nBBId[i] = pBB->nBBId;
+        pSet->prob[i] = (float)pBB->prob;
+    }
+}
+
 #ifdef __cplusplus
 }
 #endif
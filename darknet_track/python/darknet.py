@@ -27,7 +27,7 @@ class ANNINFO(Structure):
 # Same as tfnRaiseAnnCb
 RAISEANNFUNC = CFUNCTYPE(c_int, ANNINFO)
 
-#Same as tDetectorModel
+#Same as tDetectorModel; keep the fields in its order
 class DETECTORMODEL(Structure):
     _fields_ = [("pcCfg", c_char_p),
                 ("pcWeights", c_char_p),
@@ -37,7 +37,13 @@ class DETECTORMODEL(Structure):
                 ("fThresh", c_double),
                 ("pfnRaiseAnnCb", (RAISEANNFUNC)),
                 ("nVideoId", c_int),
-                ("isVideo", c_int)
+                ("isVideo", c_int),
+                ("nFrameId", c_int),
+                ("pcNames", c_char_p),
+                ("nBBAssocAlgo", c_int),
+                ("nProcWidth", c_int),
+                ("nProcHeight", c_int),
+                ("pcLanes", c_char_p)
                ]
 
 #lib = CDLL("/Users/gotham/work/darknet/libdarknet.so", RTLD_GLOBAL)
@@ -47,6 +47,25 @@ void flatten(float *x, int size, int layers, int batch, int forward)
     free(swap);
 }
 
+/** batch x c x spatial (CHW) to batch x spatial x c (NHWC) with to_nhwc, else back */
+void transpose_layout_cpu(float *x, int spatial, int c, int batch, int to_nhwc, float *out)
+{
+    int b, i, k;
+    for(b = 0; b < batch; ++b){
+        float *in = x + b*spatial*c;
+        float *o = out + b*spatial*c;
+        if(to_nhwc){
+            for(i = 0; i < spatial; ++i){
+                for(k = 0; k < c; ++k) o[i*c + k] = in[k*spatial + i];
+            }
+        } else {
+            for(k = 0; k < c; ++k){
+                for(i = 0; i < spatial; ++i) o[k*spatial + i] = in[i*c + k];
+            }
+        }
+    }
+}
+
 void weighted_sum_cpu(float *a, float *b, float *s, int n, float *c)
 {
     int i;
@@ -3,6 +3,7 @@
 #include "darknet.h"
 
 void flatten(float *x, int size, int layers, int batch, int forward);
+void transpose_layout_cpu(float *x, int spatial, int c, int batch, int to_nhwc, float *out);
 void pm(int M, int N, float *A);
 float *random_matrix(int rows, int cols);
 void time_random_matrix(int TA, int TB, int m, int k, int n);
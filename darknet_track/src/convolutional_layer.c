@@ -5,8 +5,14 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "winograd.h"
+#include "gemm_int8.h"
+#include "half.h"
+#include "maxpool_layer.h"
+#include "thread_pool.h"
 #include <stdio.h>
 #include <time.h>
+#include <math.h>
 
 #ifdef AI2
 #include "xnor_layer.h"
@@ -115,7 +121,63 @@ static size_t get_workspace_size(layer l){
         return most;
     }
 #endif
-    return (size_t)l.out_h*l.out_w*l.size*l.size*l.c*sizeof(float);
+    size_t im2col = (size_t)l.out_h*l.out_w*l.size*l.size*l.c*sizeof(float);
+    if(l.winograd){
+        size_t s = winograd_workspace_size(l.n, l.c, l.h, l.w)*sizeof(float);
+        if(s > im2col) im2col = s;
+    }
+    if(l.qweights){
+        size_t s = gemm_int8_input_size(l.c, l.h, l.w);
+        if(s > im2col) im2col = s;
+    }
+    return im2col;
+}
+
+/** 3x3 / stride 1 / pad 1 layers run through Winograd F(2x2,3x3) at inference.
+ * With few channels the tile transforms cost more than the multiplies they save,
+ * and on small maps (13x13) streaming the 16/9 larger transformed filters is
+ * slower than the direct GEMM at batch 1 */
+#define WINOGRAD_MIN_CHANNELS 64
+#define WINOGRAD_MIN_PIXELS 400
+
+static int use_winograd(convolutional_layer l)
+{
+    return l.size == 3 && l.stride == 1 && l.pad == 1 && !l.binary && !l.xnor && !l.weights_half && !l.nhwc
+        && l.c >= WINOGRAD_MIN_CHANNELS && l.out_h*l.out_w >= WINOGRAD_MIN_PIXELS;
+}
+
+/** refreshes the pre-transformed filters after the weights change (load, denormalize, ...) */
+void update_winograd_weights(convolutional_layer l)
+{
+    if(!l.winograd_weights || !l.weights) return;
+    winograd_transform_weights(l.weights, l.n, l.c, l.winograd_weights);
+}
+
+static void setup_winograd(convolutional_layer *l)
+{
+    l->winograd = use_winograd(*l);
+    if(l->winograd && !l->winograd_weights){
+        l->winograd_weights = (float*)calloc(16*l->c*l->n, sizeof(float));
+        update_winograd_weights(*l);
+    }
+}
+
+/** floats of conv output kept per band when a maxpool is fused in: a few hundred KB, so the band
+ * is still in L2 when it is pooled */
+#define FUSED_MAXPOOL_BAND_FLOATS (1 << 17)
+
+static int fused_maxpool_band_rows(convolutional_layer l)
+{
+    int rows = FUSED_MAXPOOL_BAND_FLOATS/(l.n*l.out_w) & ~1;
+    return rows < 2 ? 2 : rows;
+}
+
+size_t get_convolutional_inference_workspace_size(convolutional_layer l)
+{
+    if(l.fused_maxpool) return (size_t)l.n*fused_maxpool_band_rows(l)*l.out_w*sizeof(float);
+    if(l.qweights) return gemm_int8_input_size(l.c, l.h, l.w);
+    if(l.winograd) return winograd_workspace_size(l.n, l.c, l.h, l.w)*sizeof(float);
+    return 0;
 }
 
 #ifdef GPU
@@ -159,7 +221,9 @@ void cudnn_convolutional_setup(layer *l)
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam)
+/** init_weights = 0 leaves weights and weight_updates unallocated, for a layer whose weights
+ * will point into a weights map */
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int init_weights)
 {
     int i;
     convolutional_layer l;
@@ -178,8 +242,10 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.pad = padding;
     l.batch_normalize = batch_normalize;
 
-    l.weights = (float*)calloc(c*n*size*size, sizeof(float));
-    l.weight_updates = (float*)calloc(c*n*size*size, sizeof(float));
+    if(init_weights){
+        l.weights = (float*)calloc(c*n*size*size, sizeof(float));
+        l.weight_updates = (float*)calloc(c*n*size*size, sizeof(float));
+    }
 
     l.biases = (float*)calloc(n, sizeof(float));
     l.bias_updates = (float*)calloc(n, sizeof(float));
@@ -191,7 +257,9 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     float scale = sqrt(2./(size*size*c));
     //scale = .02;
     //for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_uniform(-1, 1);
-    for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_normal();
+    if(init_weights){
+        for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_normal();
+    }
     int out_w = convolutional_out_width(l);
     int out_h = convolutional_out_height(l);
     l.out_h = out_h;
@@ -304,6 +372,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
 #endif
     }
 #endif
+    setup_winograd(&l);
     l.workspace_size = get_workspace_size(l);
     l.activation = activation;
 
@@ -325,12 +394,13 @@ void denormalize_convolutional_layer(convolutional_layer l)
         l.rolling_mean[i] = 0;
         l.rolling_variance[i] = 1;
     }
+    update_winograd_weights(l);
 }
 
 /*
 void test_convolutional_layer()
 {
-    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0);
+    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0, 1);
     l.batch_normalize = 1;
     float data[] = {1,1,1,1,1,
         1,1,1,1,1,
@@ -390,6 +460,7 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     cudnn_convolutional_setup(l);
 #endif
 #endif
+    setup_winograd(l);
     l->workspace_size = get_workspace_size(*l);
 }
 
@@ -427,13 +498,197 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
     }
 }
 
+/** inference epilogue of output planes [start, end) (plane = batch*n + filter) for layers whose
+ * batch norm has not been folded: rolling batch norm, then the activation; same arithmetic as
+ * forward_batchnorm_layer() + activate_array() */
+static void conv_epilogue_range(void *ptr, int start, int end)
+{
+    convolutional_layer *l = (convolutional_layer *)ptr;
+    int spatial = l->out_h*l->out_w;
+    int p, i;
+    for(p = start; p < end; ++p){
+        int f = p % l->n;
+        float *x = l->output + p*spatial;
+        float mean = l->rolling_mean[f];
+        float div = sqrt(l->rolling_variance[f]) + .000001f;
+        for(i = 0; i < spatial; ++i){
+            x[i] = (x[i] - mean)/div;
+            x[i] *= l->scales[f];
+            x[i] += l->biases[f];
+        }
+        activate_array(x, spatial, l->activation);
+    }
+}
+
+/** l's biases and weights with its rolling batch norm folded in, written to biases and weights
+ * (which may be l's own) */
+void fold_convolutional_batchnorm_into(convolutional_layer l, float *biases, float *weights)
+{
+    int i, j;
+    int size = l.c*l.size*l.size;
+    for(i = 0; i < l.n; ++i){
+        float scale = l.scales[i]/(sqrt(l.rolling_variance[i]) + .000001f);
+        for(j = 0; j < size; ++j){
+            weights[i*size + j] = l.weights[i*size + j]*scale;
+        }
+        biases[i] = l.biases[i] - l.rolling_mean[i]*scale;
+    }
+}
+
+/**
+ * Folds the rolling batch norm into weights and biases, with the same arithmetic the forward
+ * pass uses, and turns batch_normalize off so that the conv output only needs bias + activation.
+ * Inference only: training and save_weights() need the unfolded parameters.
+ */
+void fold_convolutional_batchnorm(convolutional_layer *l)
+{
+    if(!l->batch_normalize) return;
+    fold_convolutional_batchnorm_into(*l, l->biases, l->weights);
+    l->batch_normalize = 0;
+    update_winograd_weights(*l);
+#ifdef GPU
+    if(gpu_index >= 0){
+        push_convolutional_layer(*l);
+    }
+#endif
+}
+
+/**
+ * Symmetric int8 quantization for inference, after fold_convolutional_batchnorm(): each filter
+ * gets its own scale 127/max|w|, the input the calibrated 127/qinput_range, and qscales maps the
+ * int32 sums back to floats. The fp32 weights are kept for training, saving and the GPU.
+ */
+void quantize_convolutional_layer(convolutional_layer *l)
+{
+    int i, j;
+    int size = l->c*l->size*l->size;
+    if(l->qinput_range <= 0 || l->batch_normalize || l->binary || l->xnor || l->nhwc) return;
+    signed char *q = (signed char*)calloc(l->n*size, sizeof(signed char));
+    free(l->qweights);
+    free(l->qweight_sums);
+    free(l->qscales);
+    l->qweight_sums = (int*)calloc(l->n, sizeof(int));
+    l->qscales = (float*)calloc(l->n, sizeof(float));
+    l->qinput_scale = 127./l->qinput_range;
+    for(i = 0; i < l->n; ++i){
+        float max = 0;
+        for(j = 0; j < size; ++j){
+            float v = fabs(l->weights[i*size + j]);
+            if(v > max) max = v;
+        }
+        float scale = max > 0 ? 127./max : 1;
+        for(j = 0; j < size; ++j){
+            int v = (int)roundf(l->weights[i*size + j]*scale);
+            q[i*size + j] = v;
+            l->qweight_sums[i] += v;
+        }
+        l->qscales[i] = 1./(scale*l->qinput_scale);
+    }
+    if(posix_memalign((void **)&l->qweights, 64, gemm_int8_packed_size(l->n, l->c, l->size))) error("quantize: out of memory");
+    gemm_int8_pack_weights(l->n, l->c, l->size, q, l->qweights);
+    free(q);
+}
+
+/**
+ * Replaces the fp32 weights with an fp16 copy that the GEMM widens while packing, halving the
+ * layer's weight memory. Winograd layers are left alone: they are the large-map, few-filter
+ * layers whose weights are small anyway, and the direct path would cost them their speedup.
+ * Inference only, after fold_convolutional_batchnorm()
+ */
+void convert_convolutional_weights_half(convolutional_layer *l)
+{
+    int num = l->n*l->c*l->size*l->size;
+    if(l->weights_half || l->winograd || l->nhwc || l->batch_normalize || l->binary || l->xnor) return;
+    l->weights_half = (unsigned short*)calloc(num, sizeof(unsigned short));
+    float_to_half_array(l->weights, num, l->weights_half);
+    if(!l->mapped_weights) free(l->weights);
+    l->weights = 0;
+    l->mapped_weights = 0;
+}
+
+/**
+ * Switches the layer to NHWC input and output: the filters are reordered to (kernel row, kernel
+ * col, channel) so the GEMM reads every kernel tap as a run of contiguous channels. Only for a
+ * folded fp32 layer; int8, half and Winograd layers stay planar
+ */
+void convert_convolutional_layer_nhwc(convolutional_layer *l)
+{
+    int f, ch, t;
+    int taps = l->size*l->size;
+    int size = l->c*taps;
+    if(l->nhwc || l->batch_normalize || l->binary || l->xnor || l->qweights || l->weights_half) return;
+    float *w = (float*)calloc(l->n*size, sizeof(float));
+    for(f = 0; f < l->n; ++f){
+        for(ch = 0; ch < l->c; ++ch){
+            for(t = 0; t < taps; ++t){
+                w[f*size + t*l->c + ch] = l->weights[f*size + ch*taps + t];
+            }
+        }
+    }
+    if(!l->mapped_weights) free(l->weights);
+    l->weights = w;
+    l->mapped_weights = 0;
+    free(l->winograd_weights);
+    l->winograd_weights = 0;
+    l->winograd = 0;
+    l->nhwc = 1;
+}
+
+/**
+ * Lets this layer produce the following 2x2 / stride 2 maxpool's output directly: the convolution
+ * runs in bands of output rows which are pooled while in cache, so the full-size conv output is
+ * neither written nor read back. Only for a folded fp32 implicit-GEMM layer whose output nobody
+ * else reads; returns whether the pool was fused
+ */
+int fuse_convolutional_maxpool(convolutional_layer *l, struct layer *pool)
+{
+    if(l->batch_normalize || l->binary || l->xnor || l->nhwc || l->winograd || l->qweights || l->weights_half) return 0;
+    if(pool->size != 2 || pool->stride != 2 || pool->pad != 0 || pool->nhwc) return 0;
+    l->fused_maxpool = pool;
+    pool->fused = 1;
+    return 1;
+}
+
+static void forward_convolutional_maxpool(convolutional_layer l, network net)
+{
+    maxpool_layer pool = *l.fused_maxpool;
+    int k = l.size*l.size*l.c;
+    int band = fused_maxpool_band_rows(l);
+    int rows = 2*pool.out_h;
+    int b, r;
+    for(b = 0; b < l.batch; ++b){
+        float *im = net.input + b*l.inputs;
+        for(r = 0; r < rows; r += band){
+            int nr = (rows - r < band) ? rows - r : band;
+            int j0 = r*l.out_w;
+            int n = nr*l.out_w;
+            if(l.size == 1 && l.stride == 1 && l.pad == 0){
+                gemm_bias_act_cpu(l.n, n, k, l.weights, k, im + j0, l.out_w*l.out_h,
+                        l.biases, l.activation, net.workspace, n);
+            } else {
+                gemm_im2col_band_bias_act_cpu(l.n, l.weights, k, im, l.c, l.h, l.w,
+                        l.size, l.stride, l.pad, j0, n, l.biases, l.activation, net.workspace, n);
+            }
+            forward_maxpool_band(pool, net.workspace, n, b, r/2, nr/2);
+        }
+    }
+}
+
 void forward_convolutional_layer(convolutional_layer l, network net)
 {
     int out_h = l.out_h;
     int out_w = l.out_w;
     int i;
+    /** no batch norm left (absent or folded): the bias and activation ride in the GEMM epilogue
+     * and every output is written once */
+    int fused = !net.train && !l.batch_normalize;
 
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
+    if(l.fused_maxpool && !net.train){
+        forward_convolutional_maxpool(l, net);
+        return;
+    }
+
+    if(!fused) fill_cpu(l.outputs*l.batch, 0, l.output, 1);
 
     if(l.xnor){
         binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.binary_weights);
@@ -448,24 +703,53 @@ void forward_convolutional_layer(convolutional_layer l, network net)
 
 
     float *a = l.weights;
-    float *b = net.workspace;
     float *c = l.output;
 
+    int threads = get_cpu_threads();
     for(i = 0; i < l.batch; ++i){
-        im2col_cpu(net.input, l.c, l.h, l.w, 
-                l.size, l.stride, l.pad, b);
-        gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
+        if(l.nhwc){
+            gemm_nhwc_conv_bias_act_cpu(m, l.weights, net.input, l.c, l.h, l.w, l.size, l.stride, l.pad,
+                    l.biases, l.activation, c);
+        } else if(l.qweights && fused){
+            unsigned char *q = (unsigned char *)net.workspace;
+            gemm_int8_quantize_input(net.input, l.c, l.h, l.w, l.qinput_scale, q);
+            gemm_int8_conv_cpu(m, l.qweights, l.qweight_sums, q, l.c, l.h, l.w, l.size, l.stride, l.pad,
+                    l.qscales, l.biases, l.activation, c, n);
+        } else if(l.weights_half){
+            if(l.size == 1 && l.stride == 1 && l.pad == 0){
+                gemm_half_bias_act_cpu(m,n,k,l.weights_half,k,net.input,n,l.biases,l.activation,c,n);
+            } else {
+                gemm_im2col_half_bias_act_cpu(m, l.weights_half, k, net.input, l.c, l.h, l.w,
+                        l.size, l.stride, l.pad, l.biases, l.activation, c, n);
+            }
+        } else if(l.winograd && !net.train){
+            /** winograd_weights are only refreshed on load, so training keeps the direct path */
+            winograd_conv3x3_cpu(l.winograd_weights, m, net.input, l.c, l.h, l.w,
+                    fused ? l.biases : 0, l.activation, c, net.workspace);
+        } else if(l.size == 1 && l.stride == 1 && l.pad == 0){
+            /** im2col of a 1x1 conv is the input itself */
+            if(fused) gemm_bias_act_cpu(m,n,k,a,k,net.input,n,l.biases,l.activation,c,n);
+            else gemm(0,0,m,n,k,1,a,k,net.input,n,1,c,n);
+        } else if(fused){
+            gemm_im2col_bias_act_cpu(m, a, k, net.input, l.c, l.h, l.w, l.size, l.stride, l.pad,
+                    l.biases, l.activation, c, n);
+        } else {
+            gemm_im2col_cpu(m, a, k, net.input, l.c, l.h, l.w, l.size, l.stride, l.pad, c, n);
+        }
         c += n*m;
         net.input += l.c*l.h*l.w;
     }
 
-    if(l.batch_normalize){
-        forward_batchnorm_layer(l, net);
-    } else {
-        add_bias(l.output, l.biases, l.batch, l.n, out_h*out_w);
+    if(net.train){
+        if(l.batch_normalize){
+            forward_batchnorm_layer(l, net);
+        } else {
+            add_bias(l.output, l.biases, l.batch, l.n, out_h*out_w);
+        }
+        activate_array(l.output, m*n*l.batch, l.activation);
+    } else if(!fused){
+        parallel_for(l.batch*l.n, (l.batch*l.n + 4*threads - 1)/(4*threads), conv_epilogue_range, &l);
     }
-
-    activate_array(l.output, m*n*l.batch, l.activation);
     if(l.binary || l.xnor) swap_binary(&l);
 }
 
@@ -546,6 +830,7 @@ void rgbgr_weights(convolutional_layer l)
             rgbgr_image(im);
         }
     }
+    update_winograd_weights(l);
 }
 
 void rescale_weights(convolutional_layer l, float scale, float trans)
@@ -559,6 +844,7 @@ void rescale_weights(convolutional_layer l, float scale, float trans)
             l.biases[i] += sum*trans;
         }
     }
+    update_winograd_weights(l);
 }
 
 image *get_weights(convolutional_layer l)
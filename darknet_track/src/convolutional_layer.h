@@ -25,7 +25,7 @@ void cudnn_convolutional_setup(layer *l);
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int init_weights);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
 void forward_convolutional_layer(const convolutional_layer layer, network net);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
@@ -46,5 +46,14 @@ image get_convolutional_weight(convolutional_layer layer, int i);
 int convolutional_out_height(convolutional_layer layer);
 int convolutional_out_width(convolutional_layer layer);
 
+void update_winograd_weights(convolutional_layer layer);
+void fold_convolutional_batchnorm(convolutional_layer *layer);
+void fold_convolutional_batchnorm_into(convolutional_layer layer, float *biases, float *weights);
+void quantize_convolutional_layer(convolutional_layer *layer);
+void convert_convolutional_weights_half(convolutional_layer *layer);
+void convert_convolutional_layer_nhwc(convolutional_layer *layer);
+int fuse_convolutional_maxpool(convolutional_layer *layer, struct layer *pool);
+size_t get_convolutional_inference_workspace_size(convolutional_layer layer);
+
 #endif
 
@@ -8,6 +8,8 @@
 #include "image.h"
 #include "demo.h"
 #include <sys/time.h>
+#include <semaphore.h>
+#include <errno.h>
 #include "darknet_exp.h"
 #include "multitracker.h"
 #include "cJSON.h"
@@ -47,6 +49,36 @@
 
 #define MAX_FRAMES_TO_HASH 2
 
+/** run decode, letterbox, CNN, tracking and the BB callbacks on separate threads joined by bounded
+ * queues (see run_pipeline()) instead of one after the other in demo2()'s hash loop;
+ * needs the consecutive-pair hash (MAX_FRAMES_TO_HASH == 2) and a live CNN */
+#define PIPELINED_DEMO
+#if defined(PIPELINED_DEMO) && (!defined(IMPURE_CNN) || defined(OVERRIDE_CNN) || MAX_FRAMES_TO_HASH != 2)
+#undef PIPELINED_DEMO
+#endif
+
+#ifdef PIPELINED_DEMO
+/** frames a stage may run ahead of the next one; a full queue blocks its producer */
+#define PIPE_QUEUE_DEPTH 2
+#define PIPE_STAGES 5 /**< decode, letterbox, infer, track, report */
+/** decoded frames kept for reuse; one per stage, one per queue slot and the frame the tracker holds as reference */
+#define FRAME_POOL_SIZE (PIPE_STAGES + (PIPE_STAGES - 1) * PIPE_QUEUE_DEPTH + 1)
+#else
+/** decoded frames kept for reuse; the hash holds at most MAX_FRAMES_TO_HASH live frames plus the one being read */
+#define FRAME_POOL_SIZE (MAX_FRAMES_TO_HASH + 1)
+#endif
+
+/** lanes file of a tDetectorModel without pcLanes */
+#define DEFAULT_LANES_FILE "lanes.json"
+/** lanes.json vertices are in this frame size; they are scaled to the processing size on load */
+#define LANES_REF_WIDTH 1920
+#define LANES_REF_HEIGHT 1080
+
+/** largest FFmpeg lowres shift (decode at 1/2^n) asked for when the processing size is smaller than the video */
+#define DECODE_MAX_LOWRES 3
+/** also decode only key frames when decoding at lowres; much cheaper on long-GOP video but frames come at the GOP rate, so off by default */
+//#define DECODE_KEYFRAMES_ONLY
+
 #define ABS_DIFF(a, b) ((a) > (b)) ? ((a)-(b)) : ((b)-(a))
 
 typedef struct Frame tFrame;
@@ -86,20 +118,29 @@ typedef struct
     double totalFramesInVid;
     tLanesInfo* pLanesInfo;
     int gIdx;
+    tFrame* pFreeFrames; /**< released frames with their buffers intact; see acquire_frame() */
+    pthread_mutex_t frameLock; /**< guards pFrames and pFreeFrames; frames are read and freed on different threads with PIPELINED_DEMO */
+    int nPooledFrames;
+    letterbox_table letterTable; /**< letterbox tables and scratch, reused across frames */
+    int nProcW; /**< frames are decoded or scaled to nProcW x nProcH; lanes and BBs are in this space */
+    int nProcH;
+    image display; /**< float copy of the shown frame to draw on; DISPLAY_RESULS builds only, see frame_display_image() */
+    IplImage* displayIpl; /**< 8-bit staging of display for HighGUI */
 }tDetector;
 
 struct Frame
 {
     int nFrameId;
-    image buff;
     double buff_ts;
     image buff_letter;
     tDetector* pDetector;
-    IplImage  * ipl;
     float **probs;
     box *boxes;
     int prod_lwn;
     tAnnInfo* pBBs;
+    tAnnInfo* pBBPool; /**< backing store of the detections in pBBs; one allocation per frame */
+    int nBBPoolCap;
+    int nBBPoolUsed;
     tFrameInfo frameInfoWithCpy;
     tFrame* pNext;
 };
@@ -139,6 +180,7 @@ void init_globals(tDetector* pDetector)
     pDetector->nSkipFramesCnt = 0;
     pDetector->bProcessThisFrame = 0;
     pDetector->pDetectorModel = NULL;
+    pthread_mutex_init(&pDetector->frameLock, NULL);
 }
 
 double get_wall_time()
@@ -150,6 +192,25 @@ double get_wall_time()
     return (double)time.tv_sec + (double)time.tv_usec * .000001;
 }
 
+/** a copy of pSrc in a BB node from the frame's pool; the pool holds the most BBs a frame can have */
+static tAnnInfo* alloc_bb_from_pool(tFrame* pFrame, int nMaxBBs, const tAnnInfo* pSrc)
+{
+    tAnnInfo* pBB;
+    if(!pFrame->pBBPool)
+    {
+        pFrame->pBBPool = (tAnnInfo*)calloc(nMaxBBs, sizeof(tAnnInfo));
+        pFrame->nBBPoolCap = nMaxBBs;
+        pFrame->nBBPoolUsed = 0;
+    }
+    if(pFrame->nBBPoolUsed >= pFrame->nBBPoolCap)
+        return NULL;
+    pBB = &pFrame->pBBPool[pFrame->nBBPoolUsed++];
+    *pBB = *pSrc;
+    pBB->bPooled = 1;
+    pBB->pNext = NULL;
+    return pBB;
+}
+
 void evaluate_detections(tFrame* pFrame, image im, int num, float thresh, box *boxes, float **probs, char **names, image **alphabet, int classes)
 {
     int i;
@@ -186,9 +247,8 @@ void evaluate_detections(tFrame* pFrame, image im, int num, float thresh, box *b
             rgb[2] = blue;
             box b = boxes[i];
 
-            int w, h;
-            w = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_FRAME_WIDTH);
-            h = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_FRAME_HEIGHT);
+            int w = pDetector->nProcW;
+            int h = pDetector->nProcH;
             int left  = (b.x-b.w/2.)*w;
             int right = (b.x+b.w/2.)*w;
             int top   = (b.y-b.h/2.)*h;
@@ -200,11 +260,14 @@ void evaluate_detections(tFrame* pFrame, image im, int num, float thresh, box *b
             if(bot > im.h-1) bot = im.h-1;
 
 #ifdef DISPLAY_RESULS
-            draw_box_width(im, left, top, right, bot, width, red, green, blue);
-            if (alphabet) {
-                image label = get_label(alphabet, names[class_], (im.h*.03)/10);
-                draw_label(im, top + width, left, label, rgb);
-                free_image(label);
+            /** an image without data only gives the frame size; show_detections() draws the boxes */
+            if(im.data){
+                draw_box_width(im, left, top, right, bot, width, red, green, blue);
+                if (alphabet) {
+                    image label = get_label(alphabet, names[class_], (im.h*.03)/10);
+                    draw_label(im, top + width, left, label, rgb);
+                    free_image(label);
+                }
             }
 #endif
             LOGV("box x:%f y:%f w:%f h:%f; l:%d r:%d t:%d b:%d\n", b.x, b.y, b.w, b.h, left, right, top, bot);
@@ -212,10 +275,9 @@ void evaluate_detections(tFrame* pFrame, image im, int num, float thresh, box *b
             annInfo.y = (int)(top);
             annInfo.w = (int)(right - left);
             annInfo.h = (int)(bot - top);
-            annInfo.pcClassName = (char*)calloc(1, strlen(names[class_]) + 1);
+            annInfo.pcClassName = names[class_];
             annInfo.nClassId = class_;
             annInfo.nBBId = pDetector->nBBCount++; /**< the unique object ID assigned to the BB initially by detector; used in IMPURE_CNN mode */
-            strcpy(annInfo.pcClassName, names[class_]);
             if(pDetector->pDetectorModel->isVideo)
                 annInfo.fCurrentFrameTimeStamp = pFrame->buff_ts;
             else
@@ -231,27 +293,61 @@ void evaluate_detections(tFrame* pFrame, image im, int num, float thresh, box *b
                 pDetector->pDetectorModel->pfnRaiseAnnCb(annInfo);
             #endif
             /** add BB to the linked list */
-            tAnnInfo* pBB = (tAnnInfo*)calloc(1, sizeof(tAnnInfo));
-            *pBB = annInfo;
+            tAnnInfo* pBB = alloc_bb_from_pool(pFrame, num, &annInfo);
+            if(!pBB)
+                break;
             pBB->pNext = pFrame->pBBs;
             pFrame->pBBs = pBB;
         }
     }
 }
 
-void *detect_in_thread(void *ptr)
+#ifdef DISPLAY_RESULS
+/**
+ * float copy of pFrame's 8-bit pixels to draw the detections on; frames are shown one at a time,
+ * so the detector keeps one such buffer and remakes it only when the frame size changes
+ */
+static image frame_display_image(tDetector* pDetector, tFrame* pFrame)
 {
-    tFrame* pFrame = (tFrame*)ptr;
-    tDetector* pDetector = pFrame->pDetector;
-    LOGD("DEBUGME\n");
-    pDetector->running = 1;
-    float nms = .4;
+    image im = pFrame->frameInfoWithCpy.im;
+    int i;
+    if(pDetector->display.w != im.w || pDetector->display.h != im.h || pDetector->display.c != im.c)
+    {
+        free_image(pDetector->display);
+        if(pDetector->displayIpl)
+            cvReleaseImage(&pDetector->displayIpl);
+        pDetector->display = make_image(im.w, im.h, im.c);
+        pDetector->displayIpl = cvCreateImage(cvSize(im.w, im.h), IPL_DEPTH_8U, im.c);
+    }
+    for(i = 0; i < im.h; ++i)
+        memcpy(pDetector->displayIpl->imageData + i*pDetector->displayIpl->widthStep, (char*)im.data + i*pFrame->frameInfoWithCpy.widthStep, im.w*im.c);
+    ipl_into_image(pDetector->displayIpl, pDetector->display);
+    rgbgr_image(pDetector->display);
+    return pDetector->display;
+}
+#endif
 
+/**
+ * draw pFrame's detections and show it in the "Demo" window;
+ * HighGUI is not thread safe, so all the showing is done on one thread
+ */
+static void show_detections(tDetector* pDetector, tFrame* pFrame)
+{
+#ifdef DISPLAY_RESULS
+    image display = frame_display_image(pDetector, pFrame);
+    draw_detections(display, pDetector->demo_detections, pDetector->demo_thresh, pFrame->boxes, pFrame->probs, pDetector->demo_names, pDetector->demo_alphabet, pDetector->demo_classes);
+    display_in_thread(pFrame);
+#endif
+}
+
+/**
+ * turn the last layer's output for pFrame into pFrame->pBBs
+ * @param prediction [IN] pFrame's slice of the net output; l.outputs floats
+ */
+static void process_detections(tDetector* pDetector, tFrame* pFrame, float* prediction)
+{
+    float nms = .4;
     layer l = pDetector->net.layers[pDetector->net.n-1];
-    float *X = pFrame->buff_letter.data;
-    LOGD("DEBUGME\n");
-    float *prediction = network_predict(pDetector->net, X);
-    LOGD("DEBUGME\n");
 
 #if 0
     memcpy(pDetector->predictions[pDetector->demo_index], prediction, l.outputs*sizeof(float));
@@ -260,17 +356,19 @@ void *detect_in_thread(void *ptr)
     if(pDetector->demo_delay == 0) l.output = pDetector->avg;
 #endif
     l.output = prediction;
+    /** prediction is one frame's slice of a batched net; batch 2 would make get_region_boxes() average in a flipped copy */
+    l.batch = 1;
     if(l.type == DETECTION){
         LOGD("DETECTION!\n\n\n\n");
         get_detection_boxes(l, 1, 1, pDetector->demo_thresh, pFrame->probs, pFrame->boxes, 0);
     } else if (l.type == REGION){
         LOGD("REGION! buf[0].w=%d h=%d net.w=%d h=%d\n\n\n\n",
-            pFrame->buff.w,
-            pFrame->buff.h,
+            pFrame->frameInfoWithCpy.im.w,
+            pFrame->frameInfoWithCpy.im.h,
             pDetector->net.w,
             pDetector->net.h
             );
-        get_region_boxes(l, pFrame->buff.w, pFrame->buff.h, pDetector->net.w, pDetector->net.h, pDetector->demo_thresh, pFrame->probs, pFrame->boxes, 0, 0, pDetector->demo_hier, 1);
+        get_region_boxes(l, pFrame->frameInfoWithCpy.im.w, pFrame->frameInfoWithCpy.im.h, pDetector->net.w, pDetector->net.h, pDetector->demo_thresh, pFrame->probs, pFrame->boxes, 0, 0, pDetector->demo_hier, 1);
     } else {
         error("Last layer must produce detections\n");
     }
@@ -280,118 +378,299 @@ void *detect_in_thread(void *ptr)
     //LOGD("\033[1;1H");
     //LOGD("\nFPS:%.1f\n",pDetector->fps);
     LOGD("Objects:\n\n");
-    image display = pFrame->buff;
-    LOGD("Draw detections pDetector->demo_detections=%d demo_classes=%d demo_thresh=%f\n", pDetector->demo_detections, pDetector->demo_classes, pDetector->demo_thresh);
-    #ifdef DISPLAY_RESULS
-    draw_detections(display, pDetector->demo_detections, pDetector->demo_thresh, pFrame->boxes, pFrame->probs, pDetector->demo_names, pDetector->demo_alphabet, pDetector->demo_classes);
-    #endif
+    /** the frame size only; the boxes are drawn by show_detections() on the display thread */
+    image display = make_empty_image(pFrame->frameInfoWithCpy.im.w, pFrame->frameInfoWithCpy.im.h, pFrame->frameInfoWithCpy.im.c);
     LOGV("frame BBs=%p\n", pFrame->pBBs);
     evaluate_detections(pFrame, display, pDetector->demo_detections, pDetector->demo_thresh, pFrame->boxes, pFrame->probs, pDetector->demo_names, pDetector->demo_alphabet, pDetector->demo_classes);
     LOGV("frame BBs=%p\n", pFrame->pBBs);
     pDetector->demo_index = (pDetector->demo_index + 1)%pDetector->demo_frame;
     LOGD("demo_index=%d; demo_frame=%d\n", pDetector->demo_index, pDetector->demo_frame);
     pDetector->running = 0;
-    #ifdef DISPLAY_RESULS
-    display_in_thread(pFrame);
-    #endif
     LOGV("cpy w=%d h=%d c=%d\n", pFrame->frameInfoWithCpy.im.w, pFrame->frameInfoWithCpy.im.h, pFrame->frameInfoWithCpy.im.c);
     #ifdef TEST_TRACKING
     tAnnInfo* pOutBBs = NULL;
     track_bb_in_frame(pFrame->pBBs, &pFrame->frameInfoWithCpy, &pFrame->frameInfoWithCpy, &pOutBBs);
     free_BBs(pOutBBs);
     #endif
+}
+
+void *detect_in_thread(void *ptr)
+{
+    tFrame* pFrame = (tFrame*)ptr;
+    tDetector* pDetector = pFrame->pDetector;
+    LOGD("DEBUGME\n");
+    pDetector->running = 1;
+
+    float *X = pFrame->buff_letter.data;
+    LOGD("DEBUGME\n");
+    float *prediction = network_predict(pDetector->net, X);
+    LOGD("DEBUGME\n");
+    process_detections(pDetector, pFrame, prediction);
     return 0;
 }
 
 
-/** 
- * NOTE: not thread safe
- */
-tFrame* get_frame_from_cap(tDetector* pDetector, tFrame* apReuseFrame, double seekPos, int bSeek, int bSeekBackAfterRead)
+static void destroy_frame(tFrame* apFrame)
 {
-    int status = -1;
-    tFrame* pFrame = apReuseFrame ? apReuseFrame : NULL;
-    double buff_ts = 0.0;
-        
-    if(apReuseFrame)
+    if(apFrame->boxes)
+        free(apFrame->boxes);
+    if(apFrame->probs)
     {
-        buff_ts = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_MSEC);
-        status = fill_image_from_stream_sj(pDetector->cap, pFrame->buff, &pFrame->frameInfoWithCpy);
-        letterbox_image_into(pFrame->buff, pDetector->net.w, pDetector->net.h, pFrame->buff_letter);
-        LOGD("status = %d\n", status);
+        /** all rows share one allocation; see acquire_frame() */
+        free(apFrame->probs[0]);
+        free(apFrame->probs);
     }
-    else
+    free_image(apFrame->buff_letter);
+    free_BBs(apFrame->pBBs);
+    free(apFrame->pBBPool);
+    free_image(apFrame->frameInfoWithCpy.im);
+    free(apFrame);
+}
+
+/**
+ * a frame with buffers for a w x h x c capture, taken from pDetector's free list when one of the
+ * same size is there; else allocated. Only the first FRAME_POOL_SIZE frames ever hit the allocator
+ */
+static tFrame* acquire_frame(tDetector* pDetector, int w, int h, int c)
+{
+    tFrame* pFrame;
+    tFrame** ppFrame = &pDetector->pFreeFrames;
+    layer l = pDetector->net.layers[pDetector->net.n-1];
+    int nProbs = l.w*l.h*l.n;
+    int j;
+
+    pthread_mutex_lock(&pDetector->frameLock);
+    while(*ppFrame)
     {
-        int j;
-        layer l = pDetector->net.layers[pDetector->net.n-1];
-        tFrameInfo frameInfoWithCpy;
-        double curPos = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES);
-        LOGV("curPos now = %f\n", curPos);
-        if(bSeek)
+        pFrame = *ppFrame;
+        image im = pFrame->frameInfoWithCpy.im;
+        if(im.w == w && im.h == h && im.c == c && pFrame->prod_lwn == nProbs)
         {
-            cvSetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES, seekPos);
-            while(cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES) <= seekPos)
-            {    
-                if(!cvGrabFrame(pDetector->cap))
-                {
-                   status = 0;
-                   #if 0
-                   image buff1 = get_image_from_stream_sj(pDetector->cap, &frameInfoWithCpy);
-                   LOGV("last frame?=%p\n", buff1.data);
-                   free_image(buff1);
-                   #endif
-                   break;
-                }
-            }
-            LOGV("now = %f; seek for %f\n", cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES), seekPos);
-            buff_ts = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_MSEC) - (1.0 / cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_FPS));
+            *ppFrame = pFrame->pNext;
+            pDetector->nPooledFrames--;
+            pFrame->pNext = NULL;
+            pthread_mutex_unlock(&pDetector->frameLock);
+            return pFrame;
         }
-        else
-        {
-#ifdef IMAGE_LIST
-            char filename[1024] = {0};
-            snprintf(filename, 1024, "/media/unnikrishnan/Qi/2DMOT2015/train/Venice-2/img1/%06d.jpg", ++pDetector->gIdx);
-            pDetector->cap = cvCaptureFromFile(filename);
-#endif /**< IMAGE_LIST */
-            buff_ts = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_MSEC);
-        }
-        image buff = get_image_from_stream_sj(pDetector->cap, &frameInfoWithCpy);
-        LOGV("now = %f\n", cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES));
-        if(bSeekBackAfterRead)
+        ppFrame = &pFrame->pNext;
+    }
+    pthread_mutex_unlock(&pDetector->frameLock);
+
+    pFrame = (tFrame*)calloc(1, sizeof(tFrame));
+    pFrame->pDetector = pDetector;
+    pFrame->buff_letter = make_image(pDetector->net.w, pDetector->net.h, c);
+    fill_image(pFrame->buff_letter, .5);
+    pFrame->prod_lwn = nProbs;
+    pFrame->boxes = (box *)calloc(nProbs, sizeof(box));
+    pFrame->probs = (float **)calloc(nProbs, sizeof(float *));
+    pFrame->probs[0] = (float *)calloc(nProbs * (l.classes+1), sizeof(float));
+    for(j = 1; j < nProbs; ++j) pFrame->probs[j] = pFrame->probs[0] + j*(l.classes+1);
+    return pFrame;
+}
+
+/** 
+ * hand apFrame's buffers back to the pool; placeholder frames (no buffers) are just freed
+ * NOTE: call with pDetector->frameLock held
+ */
+static void release_frame(tDetector* pDetector, tFrame* apFrame)
+{
+    if(!apFrame->frameInfoWithCpy.im.data || pDetector->nPooledFrames >= FRAME_POOL_SIZE)
+    {
+        destroy_frame(apFrame);
+        return;
+    }
+    free_BBs(apFrame->pBBs);
+    apFrame->pBBs = NULL;
+    apFrame->nBBPoolUsed = 0;
+    apFrame->nFrameId = 0;
+    apFrame->buff_ts = 0;
+    apFrame->pNext = pDetector->pFreeFrames;
+    pDetector->pFreeFrames = apFrame;
+    pDetector->nPooledFrames++;
+}
+
+/** free every pooled frame, the letterbox scratch and the display buffer */
+static void drain_frame_pool(tDetector* pDetector)
+{
+    while(pDetector->pFreeFrames)
+    {
+        tFrame* pFrame = pDetector->pFreeFrames;
+        pDetector->pFreeFrames = pFrame->pNext;
+        destroy_frame(pFrame);
+    }
+    pDetector->nPooledFrames = 0;
+    free_letterbox_table(&pDetector->letterTable);
+    free_image(pDetector->display);
+    pDetector->display = make_empty_image(0, 0, 0);
+    if(pDetector->displayIpl)
+        cvReleaseImage(&pDetector->displayIpl);
+}
+
+/**
+ * set pDetector's processing size from its model's nProcWidth x nProcHeight for a srcW x srcH video;
+ * a 0 dimension follows the other at the video's aspect, both 0 keep the video's size; never upscales
+ */
+static void set_processing_size(tDetector* pDetector, int srcW, int srcH)
+{
+    int w = pDetector->pDetectorModel ? pDetector->pDetectorModel->nProcWidth : 0;
+    int h = pDetector->pDetectorModel ? pDetector->pDetectorModel->nProcHeight : 0;
+
+    if(srcW > 0 && srcH > 0)
+    {
+        if(!w && !h)
         {
-            cvSetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES, curPos+1);
+            w = srcW;
+            h = srcH;
         }
-        LOGD("DEBUGME\n");
-        if(!buff.data)
+        else if(!w)
+            w = (int)((double)srcW * h / srcH + .5);
+        else if(!h)
+            h = (int)((double)srcH * w / srcW + .5);
+        if(w > srcW || h > srcH)
         {
-            status = 0;
-            LOGV("could not read!\n");
-            goto cleanup;
+            w = srcW;
+            h = srcH;
         }
-      
-        pFrame = (tFrame*)calloc(1, sizeof(tFrame));
-        pFrame->nFrameId = pDetector->gIdx;
-        pFrame->frameInfoWithCpy = frameInfoWithCpy;
-        pFrame->buff = buff;
-        LOGD("DEBUGME\n");
-        pFrame->buff_letter = letterbox_image(pFrame->buff, pDetector->net.w, pDetector->net.h);
-        pFrame->ipl = cvCreateImage(cvSize(pFrame->buff.w,pFrame->buff.h), IPL_DEPTH_8U, pFrame->buff.c);
-        pFrame->pNext = pDetector->pFrames;
-        pDetector->pFrames = pFrame;
-        pFrame->prod_lwn = l.w*l.h*l.n;
-        //for(j = 0; j < pDetector->demo_frame; ++j) pDetector->predictions[j] = (float *) calloc(l.outputs, sizeof(float));
-
-        pFrame->boxes = (box *)calloc(l.w*l.h*l.n, sizeof(box));
-        pFrame->probs = (float **)calloc(l.w*l.h*l.n, sizeof(float *));
-        for(j = 0; j < l.w*l.h*l.n; ++j) pFrame->probs[j] = (float *)calloc(l.classes+1, sizeof(float));
-
-        pFrame->pDetector = pDetector;
     }
+    pDetector->nProcW = w;
+    pDetector->nProcH = h;
+    LOGD("video %dx%d; processing at %dx%d\n", srcW, srcH, w, h);
+}
+
+/** OPENCV_FFMPEG_CAPTURE_OPTIONS is process wide; open_capture() holds this while it is changed */
+static pthread_mutex_t gCaptureOptionsLock = PTHREAD_MUTEX_INITIALIZER;
 
-    if(pFrame)
+/**
+ * open filename and set pDetector's processing size for it
+ * when that is at most half the video's size, the FFmpeg backend is asked (OPENCV_FFMPEG_CAPTURE_OPTIONS) to
+ * decode at 1/2^n resolution (lowres) where the codec supports it and to skip the deblocking filter;
+ * whatever size comes out is area-resampled to the processing size in ipl_into_frame_info_scaled()
+ */
+static CvCapture* open_capture(tDetector* pDetector, const char* filename)
+{
+    const char* pcEnv = "OPENCV_FFMPEG_CAPTURE_OPTIONS";
+    char acOptions[64] = {0};
+    char* pcPrevOptions = NULL;
+    char* pcOptions;
+    int srcW, srcH;
+    int nLowres = 0;
+    CvCapture* cap;
+
+    /** the size probe must not pick up another stream's options either */
+    pthread_mutex_lock(&gCaptureOptionsLock);
+    cap = cvCaptureFromFile(filename);
+    if(!cap)
     {
-        pFrame->frameInfoWithCpy.fCurrentFrameTimeStamp = pFrame->buff_ts = buff_ts;
+        pthread_mutex_unlock(&gCaptureOptionsLock);
+        return NULL;
     }
+    srcW = (int)cvGetCaptureProperty(cap, CV_CAP_PROP_FRAME_WIDTH);
+    srcH = (int)cvGetCaptureProperty(cap, CV_CAP_PROP_FRAME_HEIGHT);
+    set_processing_size(pDetector, srcW, srcH);
+    while(pDetector->nProcW > 0 && nLowres < DECODE_MAX_LOWRES && (srcW >> (nLowres + 1)) >= pDetector->nProcW
+        && (srcH >> (nLowres + 1)) >= pDetector->nProcH)
+        nLowres++;
+    if(nLowres == 0)
+    {
+        pthread_mutex_unlock(&gCaptureOptionsLock);
+        return cap;
+    }
+
+    snprintf(acOptions, sizeof(acOptions), "lowres;%d|skip_loop_filter;all", nLowres);
+#ifdef DECODE_KEYFRAMES_ONLY
+    strncat(acOptions, "|skip_frame;nokey", sizeof(acOptions) - strlen(acOptions) - 1);
+#endif
+    /** the backend reads the options when the file is opened, so reopen with them added to the user's */
+    cvReleaseCapture(&cap);
+    if(getenv(pcEnv) && getenv(pcEnv)[0])
+    {
+        pcPrevOptions = strdup(getenv(pcEnv));
+        pcOptions = calloc(strlen(pcPrevOptions) + strlen(acOptions) + 2, 1);
+        sprintf(pcOptions, "%s|%s", pcPrevOptions, acOptions);
+    }
+    else
+    {
+        pcPrevOptions = getenv(pcEnv) ? strdup(getenv(pcEnv)) : NULL;
+        pcOptions = strdup(acOptions);
+    }
+    setenv(pcEnv, pcOptions, 1);
+    cap = cvCaptureFromFile(filename);
+    if(pcPrevOptions)
+        setenv(pcEnv, pcPrevOptions, 1);
+    else
+        unsetenv(pcEnv);
+    pthread_mutex_unlock(&gCaptureOptionsLock);
+
+    if(!cap)
+        LOGE("could not open [%s] with decode options [%s]\n", filename, pcOptions);
+    else
+        LOGD("decode options [%s]\n", pcOptions);
+    free(pcPrevOptions);
+    free(pcOptions);
+    return cap;
+}
+
+/** 
+ * read the next (or the seekPos'th) frame into a pooled frame; the letterboxed CNN input is left stale
+ * NOTE: not thread safe against other readers of pDetector->cap
+ */
+static tFrame* decode_frame_from_cap(tDetector* pDetector, double seekPos, int bSeek, int bSeekBackAfterRead)
+{
+    int status = -1;
+    tFrame* pFrame = NULL;
+    double buff_ts = 0.0;
+    IplImage* src;
+    double curPos = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES);
+    LOGV("curPos now = %f\n", curPos);
+    if(bSeek)
+    {
+        cvSetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES, seekPos);
+        while(cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES) <= seekPos)
+        {    
+            if(!cvGrabFrame(pDetector->cap))
+            {
+               status = 0;
+               break;
+            }
+        }
+        LOGV("now = %f; seek for %f\n", cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES), seekPos);
+        buff_ts = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_MSEC) - (1.0 / cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_FPS));
+    }
+    else
+    {
+#ifdef IMAGE_LIST
+        char filename[1024] = {0};
+        snprintf(filename, 1024, "/media/unnikrishnan/Qi/2DMOT2015/train/Venice-2/img1/%06d.jpg", ++pDetector->gIdx);
+        pDetector->cap = cvCaptureFromFile(filename);
+#endif /**< IMAGE_LIST */
+        buff_ts = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_MSEC);
+    }
+    src = cvQueryFrame(pDetector->cap);
+    if(!src)
+    {
+        status = 0;
+        LOGV("could not read!\n");
+        goto cleanup;
+    }
+    /** fill the pooled frame before the seek-back below; cvSetCaptureProperty may invalidate src */
+    if(pDetector->nProcW <= 0 || pDetector->nProcH <= 0)
+        set_processing_size(pDetector, src->width, src->height);
+    pFrame = acquire_frame(pDetector, pDetector->nProcW, pDetector->nProcH, src->nChannels);
+    ipl_into_frame_info_scaled(src, &pFrame->frameInfoWithCpy, pDetector->nProcW, pDetector->nProcH);
+    LOGV("now = %f\n", cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES));
+    if(bSeekBackAfterRead)
+    {
+        cvSetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_FRAMES, curPos+1);
+    }
+    LOGD("DEBUGME\n");
+  
+    pFrame->nFrameId = pDetector->gIdx;
+    pFrame->frameInfoWithCpy.fCurrentFrameTimeStamp = pFrame->buff_ts = buff_ts;
+    pthread_mutex_lock(&pDetector->frameLock);
+    pFrame->pNext = pDetector->pFrames;
+    pDetector->pFrames = pFrame;
+    pthread_mutex_unlock(&pDetector->frameLock);
+
     cleanup:
 
     if(status == 0) pDetector->demo_done = 1;
@@ -399,15 +678,54 @@ tFrame* get_frame_from_cap(tDetector* pDetector, tFrame* apReuseFrame, double se
     return pFrame;
 }
 
+/** 
+ * NOTE: not thread safe
+ */
+static void letterbox_frame(tDetector* pDetector, tFrame* pFrame)
+{
+    tFrameInfo* pInfo = &pFrame->frameInfoWithCpy;
+    letterbox_bytes_into((unsigned char*)pInfo->im.data, pInfo->im.w, pInfo->im.h, pInfo->im.c, pInfo->widthStep, 1,
+        pFrame->buff_letter, &pDetector->letterTable);
+}
+
+/** 
+ * NOTE: not thread safe
+ */
+tFrame* get_frame_from_cap(tDetector* pDetector, tFrame* apReuseFrame, double seekPos, int bSeek, int bSeekBackAfterRead)
+{
+    int status = -1;
+    tFrame* pFrame = apReuseFrame;
+        
+    if(apReuseFrame)
+    {
+        pFrame->buff_ts = cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_POS_MSEC);
+        pFrame->frameInfoWithCpy.fCurrentFrameTimeStamp = pFrame->buff_ts;
+        status = fill_frame_info_from_stream(pDetector->cap, &pFrame->frameInfoWithCpy, pDetector->nProcW, pDetector->nProcH);
+        letterbox_frame(pDetector, pFrame);
+        LOGD("status = %d\n", status);
+        if(status == 0) pDetector->demo_done = 1;
+    }
+    else
+    {
+        pFrame = decode_frame_from_cap(pDetector, seekPos, bSeek, bSeekBackAfterRead);
+        if(pFrame)
+            letterbox_frame(pDetector, pFrame);
+    }
+
+    return pFrame;
+}
+
 /** 
  * NOTE: not thread safe
  */
 void free_frame(tDetector* pDetector, tFrame* apFrame)
 {
-    tFrame* pFrame = pDetector->pFrames;
+    tFrame* pFrame;
     tFrame* pFramePrev = NULL;
     if(!apFrame)
         return;
+    pthread_mutex_lock(&pDetector->frameLock);
+    pFrame = pDetector->pFrames;
     while(pFrame)
     {
         if(pFrame == apFrame)
@@ -422,20 +740,8 @@ void free_frame(tDetector* pDetector, tFrame* apFrame)
         pFramePrev = pFrame;
         pFrame = pFrame->pNext;
     }
-    free_image(apFrame->buff);
-    if(apFrame->boxes)
-        free(apFrame->boxes);
-    if(apFrame->probs)
-    {
-        for(int i = 0;i < apFrame->prod_lwn; i++)
-            free(apFrame->probs[i]);
-        free(apFrame->probs);
-    }
-    free_image(apFrame->buff_letter);
-    free_BBs(apFrame->pBBs);
-    free_image(apFrame->frameInfoWithCpy.im);
-    cvReleaseImage(&apFrame->ipl);
-    free(apFrame);
+    release_frame(pDetector, apFrame);
+    pthread_mutex_unlock(&pDetector->frameLock);
 }
 
 void *fetch_in_thread(void *ptr)
@@ -454,7 +760,7 @@ void *display_in_thread(void *ptr)
     tFrame* pFrame = (tFrame*)ptr;
     tDetector* pDetector = pFrame->pDetector;
     LOGD("DEBUGME %p\n", pDetector);
-    show_image_cv(pFrame->buff, "Demo", pFrame->ipl);
+    show_image_cv(pDetector->display, "Demo", pDetector->displayIpl);
     int c = cvWaitKey(1);
     if (c != -1) c = c%256;
     if (c == 10){
@@ -634,11 +940,14 @@ int interpolate_bbs_btw_frames(tDetector* pDetector, tFrame** ppFramesHashBase,
     LOGV("DEBUGME\n");
     pFrame1 = ppFramesHashBase[nF];
     pFrameL = ppFramesHashBase[nL];
+    /** BBs are added only to the frames in between; the index over pFrame1 stays valid */
+    tBBIdIndex frame1Index;
+    build_bb_id_index(&frame1Index, pFrame1->pBBs);
     pBB2 = pFrameL->pBBs;
     while(pBB2)
     {
         LOGV("DEBUGME\n");
-        if((pBB1 = if_bb_in_bbs(pBB2, pFrame1->pBBs)))
+        if((pBB1 = find_bb_by_id(&frame1Index, pBB2->nBBId)))
         {
             LOGV("DEBUGME\n");
             /** find D=displacement between the objects;
@@ -669,8 +978,7 @@ int interpolate_bbs_btw_frames(tDetector* pDetector, tFrame** ppFramesHashBase,
                     bbb1i = interpolateBoundingBox(bbb1, bbb2, fFrac);
                     LOGV("bbb1i (%d, %d) -> (%d, %d)\n", bbb1i.xMin, bbb1i.yMin, bbb1i.xMax, bbb1i.yMax);
                     memcpy(pBB1i, pBB1, sizeof(tAnnInfo));
-                    pBB1i->pcClassName = (char*)malloc(strlen(pBB1->pcClassName) + 1);
-                    strcpy(pBB1i->pcClassName, pBB1->pcClassName);
+                    pBB1i->bPooled = 0;
                     get_BB_from_bbbounds(pBB1i, &bbb1i);
                     pBB1i->fCurrentFrameTimeStamp = pBB1->fCurrentFrameTimeStamp + (((pBB2->fCurrentFrameTimeStamp - pBB1->fCurrentFrameTimeStamp) / (nL - nF)) * i);
                     pBB1i->pNext = ppFramesHashBase[i]->pBBs;
@@ -680,10 +988,163 @@ int interpolate_bbs_btw_frames(tDetector* pDetector, tFrame** ppFramesHashBase,
         }
         pBB2 = pBB2->pNext;
     }
+    free_bb_id_index(&frame1Index);
 
     return missedInLast;
 }
 
+static const char* lanes_file(tDetectorModel* pModel)
+{
+    return (pModel && pModel->pcLanes) ? pModel->pcLanes : DEFAULT_LANES_FILE;
+}
+
+/**
+ * load the lanes for this stream from its lanes file (or ask the user to draw them on pFrame and
+ * save them there) and size the per-lane / per-route counters
+ */
+static void init_lanes_for_frame(tDetector* pDetector, tFrame* pFrame)
+{
+    const char* pcLanesFile = lanes_file(pDetector->pDetectorModel);
+    FILE* pFile = fopen(pcLanesFile, "r");
+    if(pFile && !pDetector->pLanesInfo)
+    {
+        cJSON* pJSONPolys = NULL;
+        {
+            char* lane_info = calloc(1, 10240);
+            int j = 0;
+            while(fread(&lane_info[j], sizeof(char), 1, pFile))
+            {
+                j++;
+            }
+            LOGV("lane_info is [%s]\n", lane_info);
+            pJSONPolys = cJSON_Parse(lane_info);
+            free(lane_info);
+        }
+        int nJSONPolys = 0;
+        if(pJSONPolys && (nJSONPolys = cJSON_GetArraySize(pJSONPolys)))
+        {
+            LOGV("DEBUGME\n");
+            pDetector->pLanesInfo = (tLanesInfo*)calloc(1, sizeof(tLanesInfo));
+            LOGV("DEBUGME\n");
+            for(int j = 0; j < nJSONPolys; j++)
+            {
+                LOGV("DEBUGME\n");
+                cJSON* pJSONPoly = cJSON_GetArrayItem(pJSONPolys, j);
+                int nJSONVs = 0;
+                if(pJSONPoly)
+                {
+                    LOGV("DEBUGME\n");
+                    cJSON* pJSONLId = cJSON_GetObjectItem(pJSONPoly, "laneid");
+                    cJSON* pJSONLRoute = cJSON_GetObjectItem(pJSONPoly, "route");
+                    cJSON* pJSONVArr = cJSON_GetObjectItem(pJSONPoly, "vertices");
+                    nJSONVs = cJSON_GetArraySize(pJSONVArr);
+                    tLane* pP = (tLane*)calloc(1, sizeof(tLane));
+                    pP->nLaneId = pJSONLId->valueint;
+                    LOGV("DEBUGME\n");
+                    pP->pcRoute = (char*)calloc(1, strlen(pJSONLRoute->valuestring) + 1);
+                    strcpy(pP->pcRoute, pJSONLRoute->valuestring);
+                    LOGV("DEBUGME\n");
+                    for(int k = 0; k < nJSONVs; k++)
+                    {
+                        LOGV("DEBUGME\n");
+                        tVertex* pV = (tVertex*)calloc(1, sizeof(tVertex));
+                        cJSON* pJVertex = cJSON_GetArrayItem(pJSONVArr, k);
+                        cJSON* pJX = cJSON_GetObjectItem(pJVertex, "x");
+                        cJSON* pJY = cJSON_GetObjectItem(pJVertex, "y");
+                        LOGV("point is (%d, %d)\n", pJX->valueint, pJY->valueint);
+                        pV->x = (int)((pJX->valueint * 1.0 / LANES_REF_WIDTH) * pDetector->nProcW);
+                        pV->y = (int)((pJY->valueint * 1.0 / LANES_REF_HEIGHT) * pDetector->nProcH);
+                        pP->nVs++;
+                        pV->pNext = pP->pVs;
+                        pP->pVs = pV;
+                    LOGV("DEBUGME\n");
+                    }
+                    LOGV("DEBUGME\n");
+                    pP->pNext = pDetector->pLanesInfo->pLanes;
+                    pDetector->pLanesInfo->pLanes = pP;
+                    pDetector->pLanesInfo->nLanes++;
+                }
+            }
+                    LOGV("DEBUGME\n");
+        }
+        cJSON_free(pJSONPolys);
+    }
+    if(pFile)
+        fclose(pFile);
+#if 0
+    pDetector->pLanesInfo = getLaneInfo(&pFrame->frameInfoWithCpy, pDetector->pLanesInfo);
+#endif
+    if(!pDetector->pLanesInfo) 
+    {
+        /** ask user to provide the lane info */
+        pDetector->pLanesInfo = getLaneInfo(&pFrame->frameInfoWithCpy, NULL);
+        LOGV("polygons info=%p\n", pDetector->pLanesInfo);
+        cJSON* pJSONPolys = cJSON_CreateArray();
+        if(pDetector->pLanesInfo)
+        {
+            tLane* pP = pDetector->pLanesInfo->pLanes;
+            while(pP)
+            {
+                cJSON* pJId = cJSON_CreateNumber(pP->nLaneId);
+                cJSON* pJRoute = cJSON_CreateString("default-route");
+                cJSON* pJLaneInfo = cJSON_CreateObject();
+                cJSON_AddItemToObject(pJLaneInfo, "laneid", pJId);
+                cJSON_AddItemToObject(pJLaneInfo, "route", pJRoute);
+
+                cJSON* pJSONPoly = cJSON_CreateArray();
+                /** polygon: list of vertices in order */
+                tVertex* pV = pP->pVs;
+                while(pV)
+                {
+                    /** drawn on the processing frame; stored in LANES_REF_WIDTH x LANES_REF_HEIGHT like the ones we load */
+                    cJSON* pJX = cJSON_CreateNumber((int)((pV->x * 1.0 / pDetector->nProcW) * LANES_REF_WIDTH + .5));
+                    cJSON* pJY = cJSON_CreateNumber((int)((pV->y * 1.0 / pDetector->nProcH) * LANES_REF_HEIGHT + .5));
+                    cJSON* pJVertex = cJSON_CreateObject();
+                    cJSON_AddItemToObject(pJVertex, "x", pJX);
+                    cJSON_AddItemToObject(pJVertex, "y", pJY);
+                    cJSON_AddItemToArray(pJSONPoly, pJVertex);
+                    pV = pV->pNext;
+                }
+                cJSON_AddItemToObject(pJLaneInfo, "vertices", pJSONPoly);
+                cJSON_AddItemToArray(pJSONPolys, pJLaneInfo);
+                pP = pP->pNext;
+            }
+        }
+        LOGV("polygon info: [%s]\n", cJSON_Print(pJSONPolys));
+        LOGV("do the one time detect\n");
+        FILE* pFile = fopen(pcLanesFile, "w");
+        fprintf(pFile, "%s", cJSON_Print(pJSONPolys));
+        fclose(pFile);
+        cJSON_free(pJSONPolys);
+    }
+    /** populate pLanesInfo with class detail */
+    tLane* pLane = pDetector->pLanesInfo->pLanes;
+    while(pLane)
+    {
+        LOGV("number of demo_classes=%d\n", pDetector->demo_classes);
+        pLane->pnVehicleCount = (long long*)calloc(1, sizeof(long long) * (pDetector->demo_classes+1));
+        pLane->nTypes = pDetector->demo_classes;
+        pLane = pLane->pNext;
+    }
+    LOGV("number of lanes=%d %d\n", pDetector->pLanesInfo->nLanes, pDetector->demo_classes);
+    pDetector->pLanesInfo->ppRouteTrafficInfo = (tRouteTrafficInfo**)calloc(pDetector->pLanesInfo->nLanes+1, sizeof(tRouteTrafficInfo*));
+    for(int j = 0; j < pDetector->pLanesInfo->nLanes+1; j++)
+    {
+        pDetector->pLanesInfo->ppRouteTrafficInfo[j] = (tRouteTrafficInfo*)calloc(pDetector->pLanesInfo->nLanes+1, sizeof(tRouteTrafficInfo));
+        for(int k = 0; k < pDetector->pLanesInfo->nLanes+1; k++)
+        {
+            pDetector->pLanesInfo->ppRouteTrafficInfo[j][k].pnVehicleCount = (long long*)calloc(1, sizeof(long long) * (pDetector->demo_classes+1));
+            pDetector->pLanesInfo->ppRouteTrafficInfo[j][k].nTypes = pDetector->demo_classes;
+        }
+    }
+    pDetector->pLanesInfo->names = pDetector->demo_names;
+    pDetector->pLanesInfo->nTypes = pDetector->demo_classes;
+    set_lanes_resolution(pDetector->pLanesInfo,
+        pFrame->frameInfoWithCpy.im.w,
+        pFrame->frameInfoWithCpy.im.h);
+    display_lanes_info(pDetector->pLanesInfo);
+}
+
 void detect_object_for_frame(tDetector* pDetector, tFrame* pFrame, int count)
 {
     pthread_t detect_thread;
@@ -721,8 +1182,282 @@ void detect_object_for_frame(tDetector* pDetector, tFrame* pFrame, int count)
             pthread_join(fetch_thread, 0);
             #endif
             pthread_join(detect_thread, 0);
+            show_detections(pDetector, pFrame);
+
+}
+
+#ifdef PIPELINED_DEMO
+/**
+ * bounded single-producer single-consumer ring of frames; NULL is the end-of-stream marker.
+ * nHead is only written by the consumer and nTail only by the producer; the two semaphores
+ * just park a stage on an empty (or, for back-pressure, a full) queue
+ */
+typedef struct
+{
+    tFrame* apSlots[PIPE_QUEUE_DEPTH];
+    volatile unsigned int nHead;
+    volatile unsigned int nTail;
+    sem_t semItems;
+    sem_t semSpaces;
+    const char* pcName;
+    /** producer side occupancy counters */
+    unsigned long long nPushes;
+    unsigned long long nOccupancySum; /**< queue depth right after each push */
+    unsigned int nMaxOccupancy;
+    unsigned long long nFullWaits; /**< pushes that had to wait for the consumer */
+}tFrameQueue;
+
+typedef struct
+{
+    tDetector* pDetector;
+    tFrameQueue* pIn;  /**< NULL for the source stage */
+    tFrameQueue* pOut; /**< NULL for the sink stage */
+    const char* pcName;
+    unsigned long long nFrames;
+    double fBusyTime; /**< seconds of work, queue waits excluded */
+}tPipeStage;
+
+static void frame_queue_init(tFrameQueue* pQ, const char* pcName)
+{
+    memset(pQ, 0, sizeof(tFrameQueue));
+    pQ->pcName = pcName;
+    sem_init(&pQ->semItems, 0, 0);
+    sem_init(&pQ->semSpaces, 0, PIPE_QUEUE_DEPTH);
+}
+
+static void frame_queue_destroy(tFrameQueue* pQ)
+{
+    sem_destroy(&pQ->semItems);
+    sem_destroy(&pQ->semSpaces);
+}
+
+static void frame_queue_push(tFrameQueue* pQ, tFrame* pFrame)
+{
+    unsigned int nDepth;
+    if(sem_trywait(&pQ->semSpaces))
+    {
+        pQ->nFullWaits++;
+        while(sem_wait(&pQ->semSpaces) && errno == EINTR);
+    }
+    pQ->apSlots[pQ->nTail % PIPE_QUEUE_DEPTH] = pFrame;
+    __sync_synchronize();
+    pQ->nTail++;
+    nDepth = pQ->nTail - pQ->nHead;
+    pQ->nPushes++;
+    pQ->nOccupancySum += nDepth;
+    if(nDepth > pQ->nMaxOccupancy)
+        pQ->nMaxOccupancy = nDepth;
+    sem_post(&pQ->semItems);
+}
+
+static tFrame* frame_queue_pop(tFrameQueue* pQ)
+{
+    tFrame* pFrame;
+    while(sem_wait(&pQ->semItems) && errno == EINTR);
+    pFrame = pQ->apSlots[pQ->nHead % PIPE_QUEUE_DEPTH];
+    __sync_synchronize();
+    pQ->nHead++;
+    sem_post(&pQ->semSpaces);
+    return pFrame;
+}
+
+static void *decode_stage(void *ptr)
+{
+    tPipeStage* pStage = (tPipeStage*)ptr;
+    tDetector* pDetector = pStage->pDetector;
+    tFrame* pFrame;
+    double fStart;
+
+    while(!pDetector->demo_done)
+    {
+        fStart = get_wall_time();
+#ifdef ENABLE_VIDEO_FILE_READ_AT_TAR_FPS
+        pDetector->bProcessThisFrame = (pDetector->nCurFrameCount && !(pDetector->nCurFrameCount % pDetector->nSkipFramesCnt));
+        if(!pDetector->bProcessThisFrame)
+        {
+            cvGrabFrame(pDetector->cap);
+            pDetector->nCurFrameCount++;
+            continue;
+        }
+#endif /**< ENABLE_VIDEO_FILE_READ_AT_TAR_FPS */
+        pFrame = decode_frame_from_cap(pDetector, pDetector->countFrame, 0, 0);
+        pDetector->countFrame++;
+        pDetector->nCurFrameCount++;
+        pStage->fBusyTime += get_wall_time() - fStart;
+        if(!pFrame)
+            break;
+        pStage->nFrames++;
+        frame_queue_push(pStage->pOut, pFrame);
+    }
+    frame_queue_push(pStage->pOut, NULL);
+    return 0;
+}
+
+static void *letterbox_stage(void *ptr)
+{
+    tPipeStage* pStage = (tPipeStage*)ptr;
+    tFrame* pFrame;
+    double fStart;
+
+    while((pFrame = frame_queue_pop(pStage->pIn)))
+    {
+        fStart = get_wall_time();
+        letterbox_frame(pStage->pDetector, pFrame);
+        pStage->fBusyTime += get_wall_time() - fStart;
+        pStage->nFrames++;
+        frame_queue_push(pStage->pOut, pFrame);
+    }
+    frame_queue_push(pStage->pOut, NULL);
+    return 0;
+}
+
+static void *infer_stage(void *ptr)
+{
+    tPipeStage* pStage = (tPipeStage*)ptr;
+    tDetector* pDetector = pStage->pDetector;
+    tFrame* pFrame;
+    double fStart;
+
+    while((pFrame = frame_queue_pop(pStage->pIn)))
+    {
+        fStart = get_wall_time();
+        /** the stage is the detect thread already; no create/join per frame */
+        detect_in_thread(pFrame);
+        pDetector->fps = 1./(fStart - pDetector->demo_time);
+        pDetector->demo_time = fStart;
+        pStage->fBusyTime += get_wall_time() - fStart;
+        pStage->nFrames++;
+        frame_queue_push(pStage->pOut, pFrame);
+    }
+    frame_queue_push(pStage->pOut, NULL);
+    return 0;
+}
+
+/**
+ * tracks the detections of each frame into the next one; a frame is handed on to the report stage
+ * only once the tracker is done using it as the reference, so no two stages ever share a frame
+ */
+static void *track_stage(void *ptr)
+{
+    tPipeStage* pStage = (tPipeStage*)ptr;
+    tDetector* pDetector = pStage->pDetector;
+    tFrame* pFramePrev = NULL;
+    tFrame* pFrame;
+    double fStart;
+    double prevDumpTime = get_wall_time();
+
+    while((pFrame = frame_queue_pop(pStage->pIn)))
+    {
+        fStart = get_wall_time();
+        if(pFramePrev)
+        {
+            track_bb_in_frame(pFramePrev->pBBs, 
+                &pFramePrev->frameInfoWithCpy, 
+                &pFrame->frameInfoWithCpy,
+                &pFrame->pBBs,
+                pDetector->pLanesInfo);
+            LOGV("BBs tracked=%p\n", pFrame->pBBs);
+        }
+        /** dump lane info as and when needed; the counts are only touched on this thread */
+        if(get_wall_time() - prevDumpTime >= (1.0 * 60 * 30))
+        {
+            prevDumpTime = get_wall_time();
+            dump_lane_info(pDetector->pLanesInfo);
+        }
+        pStage->fBusyTime += get_wall_time() - fStart;
+        pStage->nFrames++;
+        if(pFramePrev)
+            frame_queue_push(pStage->pOut, pFramePrev);
+        pFramePrev = pFrame;
+    }
+    if(pFramePrev)
+        frame_queue_push(pStage->pOut, pFramePrev);
+    frame_queue_push(pStage->pOut, NULL);
+    return 0;
+}
+
+/**
+ * demo2()'s IMPURE_CNN loop as a pipeline:
+ * decode -> letterbox -> infer -> track -> report (on the calling thread, where the callbacks always ran)
+ * The first frame is read and given its lanes here, before any stage starts, as getLaneInfo() may need the UI
+ */
+static void run_pipeline(tDetector* pDetector)
+{
+    tFrameQueue aQueues[PIPE_STAGES - 1];
+    tPipeStage aStages[PIPE_STAGES];
+    pthread_t aThreads[PIPE_STAGES - 1];
+    void *(*apfnStages[PIPE_STAGES - 1])(void *) = {decode_stage, letterbox_stage, infer_stage, track_stage};
+    const char* apcNames[PIPE_STAGES] = {"decode", "letterbox", "infer", "track", "report"};
+    tPipeStage* pReport = &aStages[PIPE_STAGES - 1];
+    tFrame* pFrame;
+    double fStart;
+    int i;
+
+    pFrame = get_frame_from_cap(pDetector, NULL, pDetector->countFrame, 0, 0);
+    if(!pFrame)
+    {
+        LOGE("file read failed\n");
+        return;
+    }
+    pDetector->countFrame++;
+    pDetector->nCurFrameCount++;
+    init_lanes_for_frame(pDetector, pFrame);
 
+    memset(aStages, 0, sizeof(aStages));
+    for(i = 0; i < PIPE_STAGES; i++)
+    {
+        aStages[i].pDetector = pDetector;
+        aStages[i].pcName = apcNames[i];
+        if(i > 0)
+            aStages[i].pIn = &aQueues[i-1];
+        if(i < PIPE_STAGES - 1)
+        {
+            frame_queue_init(&aQueues[i], apcNames[i]);
+            aStages[i].pOut = &aQueues[i];
+        }
+    }
+    /** the first frame is decoded and letterboxed already; it enters at the infer stage */
+    frame_queue_push(&aQueues[1], pFrame);
+    /** the track stage must not touch HighGUI; its results are shown here with the detections */
+    set_tracker_display_inline(0);
+
+    for(i = 0; i < PIPE_STAGES - 1; i++)
+    {
+        if(pthread_create(&aThreads[i], 0, apfnStages[i], &aStages[i])) error("Thread creation failed");
+    }
+
+    while((pFrame = frame_queue_pop(pReport->pIn)))
+    {
+        fStart = get_wall_time();
+        LOGV("firing CB for frame %d BBs=%p\n", pFrame->nFrameId, pFrame->pBBs);
+        show_detections(pDetector, pFrame);
+        tracker_display_results(pFrame->pBBs, &pFrame->frameInfoWithCpy, pDetector->pLanesInfo);
+        fire_bb_callbacks_for_frame(pDetector, pFrame);
+        free_frame(pDetector, pFrame);
+        pReport->fBusyTime += get_wall_time() - fStart;
+        pReport->nFrames++;
+    }
+
+    for(i = 0; i < PIPE_STAGES - 1; i++)
+        pthread_join(aThreads[i], 0);
+    set_tracker_display_inline(1);
+
+    for(i = 0; i < PIPE_STAGES; i++)
+    {
+        LOGV("stage %-9s: %llu frames busy %fms/frame\n", aStages[i].pcName, aStages[i].nFrames,
+            aStages[i].nFrames ? (aStages[i].fBusyTime * 1000.0) / aStages[i].nFrames : 0.0);
+    }
+    for(i = 0; i < PIPE_STAGES - 1; i++)
+    {
+        LOGV("queue after %-9s: mean occupancy %f/%d max %u; producer blocked %llu times\n", aQueues[i].pcName,
+            aQueues[i].nPushes ? (aQueues[i].nOccupancySum * 1.0) / aQueues[i].nPushes : 0.0,
+            PIPE_QUEUE_DEPTH, aQueues[i].nMaxOccupancy, aQueues[i].nFullWaits);
+        frame_queue_destroy(&aQueues[i]);
+    }
+    pDetector->demo_done = 1;
+    dump_lane_info(pDetector->pLanesInfo);
 }
+#endif /**< PIPELINED_DEMO */
 
 char folder_name[100];
 
@@ -750,20 +1485,19 @@ void demo2(void* apDetector, char *cfgfile, char *weightfile, float thresh, int
     #if 0
     pDetector->predictions = (float**)calloc(pDetector->demo_frame, sizeof(float*));
     #endif
-    pDetector->net = parse_network_cfg(cfgfile);
-    if(weightfile){
-        load_weights(&pDetector->net, weightfile);
-    }
+    pDetector->net = load_network(cfgfile, weightfile, 0);
     set_batch_network(&pDetector->net, 1);
+    finalize_network_for_inference(&pDetector->net);
     initOnce = 1;
     }
 
     srand(2222222);
 
+    set_bb_association_algo(pDetector->pDetectorModel->nVideoId, (tBBAssocAlgo)pDetector->pDetectorModel->nBBAssocAlgo);
 
     if(filename){
         LOGD("video file: %s\n", filename);
-        pDetector->cap = cvCaptureFromFile(filename);
+        pDetector->cap = open_capture(pDetector, filename);
         strcpy(folder_name, strstr(filename, ".mp4") - 10);
         LOGV("folder name is %s\n", folder_name);
         LOGD("DEBUGME %p\n", pDetector->cap);
@@ -779,6 +1513,10 @@ void demo2(void* apDetector, char *cfgfile, char *weightfile, float thresh, int
         if(frames){
             cvSetCaptureProperty(pDetector->cap, CV_CAP_PROP_FPS, frames);
         }
+        /** cameras scale in the driver; w x h above is the place to ask for the processing size */
+        if(pDetector->cap)
+            set_processing_size(pDetector, (int)cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_FRAME_WIDTH),
+                (int)cvGetCaptureProperty(pDetector->cap, CV_CAP_PROP_FRAME_HEIGHT));
     }
 
     if(!pDetector->cap)
@@ -857,6 +1595,9 @@ void demo2(void* apDetector, char *cfgfile, char *weightfile, float thresh, int
 #endif
 
     LOGD("DEBUGME %d\n", pDetector->demo_done);
+#ifdef PIPELINED_DEMO
+    run_pipeline(pDetector);
+#endif /**< PIPELINED_DEMO */
     while(!pDetector->demo_done){
         LOGD("pDetector->demo_done=%d count=%d prefix=%s pDetector->nSkipFramesCnt=%d\n", pDetector->demo_done, count, prefix, pDetector->nSkipFramesCnt);
         LOGD("cap prop; w=%f h=%f frame_count=%f FPS=%f POS_MS=%f pos_count=%f\n", 
@@ -935,6 +1676,7 @@ void demo2(void* apDetector, char *cfgfile, char *weightfile, float thresh, int
                         if(pDetector->pFramesHash[0])
                             free_frame(pDetector, pDetector->pFramesHash[0]);
                         dump_lane_info(pDetector->pLanesInfo);
+                        drain_frame_pool(pDetector);
                         return;
                     }
                     nL = i - 1;
@@ -943,145 +1685,7 @@ void demo2(void* apDetector, char *cfgfile, char *weightfile, float thresh, int
                 }
                 if(i == 0)
                 {
-                    FILE* pFile = fopen("lanes.json", "r");
-                    if(pFile && !pDetector->pLanesInfo)
-                    {
-                        cJSON* pJSONPolys = NULL;
-                        {
-                            char* lane_info = calloc(1, 10240);
-                            int j = 0;
-                            while(fread(&lane_info[j], sizeof(char), 1, pFile))
-                            {
-                                j++;
-                            }
-                            LOGV("lane_info is [%s]\n", lane_info);
-                            pJSONPolys = cJSON_Parse(lane_info);
-                            free(lane_info);
-                        }
-                        int nJSONPolys = 0;
-                        if(pJSONPolys && (nJSONPolys = cJSON_GetArraySize(pJSONPolys)))
-                        {
-                            LOGV("DEBUGME\n");
-                            pDetector->pLanesInfo = (tLanesInfo*)calloc(1, sizeof(tLanesInfo));
-                            LOGV("DEBUGME\n");
-                            for(int j = 0; j < nJSONPolys; j++)
-                            {
-                                LOGV("DEBUGME\n");
-                                cJSON* pJSONPoly = cJSON_GetArrayItem(pJSONPolys, j);
-                                int nJSONVs = 0;
-                                if(pJSONPoly)
-                                {
-                                    LOGV("DEBUGME\n");
-                                    cJSON* pJSONLId = cJSON_GetObjectItem(pJSONPoly, "laneid");
-                                    cJSON* pJSONLRoute = cJSON_GetObjectItem(pJSONPoly, "route");
-                                    cJSON* pJSONVArr = cJSON_GetObjectItem(pJSONPoly, "vertices");
-                                    nJSONVs = cJSON_GetArraySize(pJSONVArr);
-                                    tLane* pP = (tLane*)calloc(1, sizeof(tLane));
-                                    pP->nLaneId = pJSONLId->valueint;
-                                    LOGV("DEBUGME\n");
-                                    pP->pcRoute = (char*)calloc(1, strlen(pJSONLRoute->valuestring) + 1);
-                                    strcpy(pP->pcRoute, pJSONLRoute->valuestring);
-                                    LOGV("DEBUGME\n");
-                                    for(int k = 0; k < nJSONVs; k++)
-                                    {
-                                        LOGV("DEBUGME\n");
-                                        tVertex* pV = (tVertex*)calloc(1, sizeof(tVertex));
-                                        cJSON* pJVertex = cJSON_GetArrayItem(pJSONVArr, k);
-                                        cJSON* pJX = cJSON_GetObjectItem(pJVertex, "x");
-                                        cJSON* pJY = cJSON_GetObjectItem(pJVertex, "y");
-                                        LOGV("point is (%d, %d)\n", pJX->valueint, pJY->valueint);
-#if 0
-                                        pV->x = pJX->valueint;
-                                        pV->y = pJY->valueint;
-#else
-                                        pV->x = (int)(((pJX->valueint * 1.0) /1920.0) * 854.0);
-                                        pV->y = (int)(((pJY->valueint * 1.0) /1080.0) * 480.0);
-#endif
-                                        pP->nVs++;
-                                        pV->pNext = pP->pVs;
-                                        pP->pVs = pV;
-                                    LOGV("DEBUGME\n");
-                                    }
-                                    LOGV("DEBUGME\n");
-                                    pP->pNext = pDetector->pLanesInfo->pLanes;
-                                    pDetector->pLanesInfo->pLanes = pP;
-                                    pDetector->pLanesInfo->nLanes++;
-                                }
-                            }
-                                    LOGV("DEBUGME\n");
-                        }
-                        cJSON_free(pJSONPolys);
-                    }
-                    if(pFile)
-                        fclose(pFile);
-#if 0
-                    pDetector->pLanesInfo = getLaneInfo(&pDetector->pFramesHash[0]->frameInfoWithCpy, pDetector->pLanesInfo);
-#endif
-                    if(!pDetector->pLanesInfo) 
-                    {
-                        /** ask user to provide the lane info */
-                        pDetector->pLanesInfo = getLaneInfo(&pDetector->pFramesHash[0]->frameInfoWithCpy, NULL);
-                        LOGV("polygons info=%p\n", pDetector->pLanesInfo);
-                        cJSON* pJSONPolys = cJSON_CreateArray();
-                        if(pDetector->pLanesInfo)
-                        {
-                            tLane* pP = pDetector->pLanesInfo->pLanes;
-                            while(pP)
-                            {
-                                cJSON* pJId = cJSON_CreateNumber(pP->nLaneId);
-                                cJSON* pJRoute = cJSON_CreateString("default-route");
-                                cJSON* pJLaneInfo = cJSON_CreateObject();
-                                cJSON_AddItemToObject(pJLaneInfo, "laneid", pJId);
-                                cJSON_AddItemToObject(pJLaneInfo, "route", pJRoute);
-
-                                cJSON* pJSONPoly = cJSON_CreateArray();
-                                /** polygon: list of vertices in order */
-                                tVertex* pV = pP->pVs;
-                                while(pV)
-                                {
-                                    cJSON* pJX = cJSON_CreateNumber(pV->x);
-                                    cJSON* pJY = cJSON_CreateNumber(pV->y);
-                                    cJSON* pJVertex = cJSON_CreateObject();
-                                    cJSON_AddItemToObject(pJVertex, "x", pJX);
-                                    cJSON_AddItemToObject(pJVertex, "y", pJY);
-                                    cJSON_AddItemToArray(pJSONPoly, pJVertex);
-                                    pV = pV->pNext;
-                                }
-                                cJSON_AddItemToObject(pJLaneInfo, "vertices", pJSONPoly);
-                                cJSON_AddItemToArray(pJSONPolys, pJLaneInfo);
-                                pP = pP->pNext;
-                            }
-                        }
-                        LOGV("polygon info: [%s]\n", cJSON_Print(pJSONPolys));
-                        LOGV("do the one time detect\n");
-                        FILE* pFile = fopen("lanes.json", "w");
-                        fprintf(pFile, "%s", cJSON_Print(pJSONPolys));
-                        fclose(pFile);
-                        cJSON_free(pJSONPolys);
-                    }
-                    /** populate pLanesInfo with class detail */
-                    tLane* pLane = pDetector->pLanesInfo->pLanes;
-                    while(pLane)
-                    {
-                        LOGV("number of demo_classes=%d\n", pDetector->demo_classes);
-                        pLane->pnVehicleCount = (long long*)calloc(1, sizeof(long long) * (pDetector->demo_classes+1));
-                        pLane->nTypes = pDetector->demo_classes;
-                        pLane = pLane->pNext;
-                    }
-                    LOGV("number of lanes=%d %d\n", pDetector->pLanesInfo->nLanes, pDetector->demo_classes);
-                    pDetector->pLanesInfo->ppRouteTrafficInfo = (tRouteTrafficInfo**)calloc(pDetector->pLanesInfo->nLanes+1, sizeof(tRouteTrafficInfo*));
-                    for(int j = 0; j < pDetector->pLanesInfo->nLanes+1; j++)
-                    {
-                        pDetector->pLanesInfo->ppRouteTrafficInfo[j] = (tRouteTrafficInfo*)calloc(pDetector->pLanesInfo->nLanes+1, sizeof(tRouteTrafficInfo));
-                        for(int k = 0; k < pDetector->pLanesInfo->nLanes+1; k++)
-                        {
-                            pDetector->pLanesInfo->ppRouteTrafficInfo[j][k].pnVehicleCount = (long long*)calloc(1, sizeof(long long) * (pDetector->demo_classes+1));
-                            pDetector->pLanesInfo->ppRouteTrafficInfo[j][k].nTypes = pDetector->demo_classes;
-                        }
-                    }
-                    pDetector->pLanesInfo->names = pDetector->demo_names;
-                    pDetector->pLanesInfo->nTypes = pDetector->demo_classes;
-                    display_lanes_info(pDetector->pLanesInfo);
+                    init_lanes_for_frame(pDetector, pDetector->pFramesHash[0]);
                     #ifdef OVERRIDE_CNN
                     pDetector->pFramesHash[0]->pBBs = pFrameTmp->pBBs;
                     pFrameTmp = pFrameTmp->pNext;
@@ -1184,6 +1788,9 @@ void demo2(void* apDetector, char *cfgfile, char *weightfile, float thresh, int
     
     LOGD("DEBUGME\n");
     //cvReleaseCapture(pDetector->cap);
+    drain_frame_pool(pDetector);
+    free_lanes_info(pDetector->pLanesInfo);
+    pDetector->pLanesInfo = NULL;
     LOGD("DEBUGME\n");
     pDetector->cap = NULL;
 }
@@ -1271,9 +1878,7 @@ tFrame* read_MOT_detection(tDetector* pDetector, char *file)
         }
         pBB->fCurrentFrameTimeStamp = (double)(pFrameTmp->nFrameId);
         pBB->nBBId = pDetector->nBBCount++; /**< the unique object ID assigned to the BB initially by detector; used in IMPURE_CNN mode */
-        char* pcClassType = "pedestrian";
-        pBB->pcClassName = (char*)malloc(strlen(pcClassType) + 1);
-        strcpy(pBB->pcClassName, pcClassType);
+        pBB->pcClassName = "pedestrian";
         /** we have 1 BB ready; prepend to the list of BBs */
         pBB->pNext = pFrameTmp->pBBs;
         pFrameTmp->pBBs = pBB;
@@ -1298,11 +1903,174 @@ void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const ch
     //return demo2(pDetector, cfgfile, weightfile, thresh, cam_index, filename, names, classes, delay, prefix, avg_frames, hier, w, h, frames, fullscreen);
     run_detector_model(pDetectorModel);
 }
+
+/**
+ * opens apDetectorModel's video for a detector sharing net; same settings as run_detector_model() + demo2()
+ * @return 0 if success, else 1
+ */
+static int init_detector_for_stream(tDetector* pDetector, tDetectorModel* apDetectorModel, network net, image **alphabet)
+{
+    layer l = net.layers[net.n-1];
+    list *options = read_data_cfg(apDetectorModel->pcDataCfg ? apDetectorModel->pcDataCfg : "cfg/aic.data");
+    char *name_list = option_find_str(options, "names", apDetectorModel->pcNames ? apDetectorModel->pcNames : "data/names.list");
+
+    init_globals(pDetector);
+    pDetector->pDetectorModel = apDetectorModel;
+    pDetector->net = net;
+    pDetector->demo_names = get_labels(name_list);
+    pDetector->demo_alphabet = alphabet;
+    pDetector->demo_classes = option_find_int(options, "classes", 20);
+    free_list(options);
+    pDetector->demo_thresh = 0.24; /**< as run_detector_model() */
+    pDetector->demo_frame = 1;
+    pDetector->demo_detections = l.n*l.w*l.h;
+    pDetector->demo_time = get_wall_time();
+    set_bb_association_algo(apDetectorModel->nVideoId, (tBBAssocAlgo)apDetectorModel->nBBAssocAlgo);
+    LOGV("stream %d: video file: %s\n", apDetectorModel->nVideoId, apDetectorModel->pcFileName);
+    pDetector->cap = apDetectorModel->pcFileName ? open_capture(pDetector, apDetectorModel->pcFileName) : NULL;
+    if(!pDetector->cap)
+    {
+        LOGE("ERROR; file could not be read [%s]\n", apDetectorModel->pcFileName);
+        pDetector->demo_done = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int run_detector_models(tDetectorModel** apDetectorModels, int nModels)
+{
+    tDetector** ppDetectors;
+    tFrame** ppFrames;
+    tFrame** ppFramesPrev; /**< per stream tracking reference; its BBs were already reported */
+    network net;
+    layer l;
+    float* pfBatchInput;
+    float* prediction;
+    image **alphabet = NULL;
+    int nLive = 0;
+    int i, j;
+
+    if(!apDetectorModels || nModels <= 0)
+        return 1;
+    /** the tracker keys its state by nVideoId; a missing lanes file is drawn and written by each stream */
+    for(i = 0; i < nModels; i++)
+    {
+        for(j = 0; j < i; j++)
+        {
+            if(apDetectorModels[i]->nVideoId == apDetectorModels[j]->nVideoId)
+            {
+                LOGE("streams %d and %d have the same nVideoId=%d\n", j, i, apDetectorModels[i]->nVideoId);
+                return 1;
+            }
+            if(!strcmp(lanes_file(apDetectorModels[i]), lanes_file(apDetectorModels[j])))
+            {
+                LOGE("streams %d and %d have the same lanes file [%s]\n", j, i, lanes_file(apDetectorModels[i]));
+                return 1;
+            }
+        }
+    }
+
+    net = load_network(apDetectorModels[0]->pcCfg, apDetectorModels[0]->pcWeights, 0);
+    set_batch_network(&net, nModels);
+    finalize_network_for_inference(&net);
+    l = net.layers[net.n-1];
+#ifdef DISPLAY_RESULS
+    alphabet = load_alphabet();
+#endif
+    srand(2222222);
+
+    pfBatchInput = (float*)calloc(nModels * net.inputs, sizeof(float));
+    ppDetectors = (tDetector**)calloc(nModels, sizeof(tDetector*));
+    ppFrames = (tFrame**)calloc(nModels, sizeof(tFrame*));
+    ppFramesPrev = (tFrame**)calloc(nModels, sizeof(tFrame*));
+    for(i = 0; i < nModels; i++)
+    {
+        ppDetectors[i] = (tDetector*)calloc(1, sizeof(tDetector));
+        if(!init_detector_for_stream(ppDetectors[i], apDetectorModels[i], net, alphabet))
+            nLive++;
+    }
+
+    /** a round is one frame from each live stream; streams which ended keep a stale slice in the batch */
+    while(nLive)
+    {
+        int nRead = 0;
+        for(i = 0; i < nModels; i++)
+        {
+            tDetector* pDetector = ppDetectors[i];
+            ppFrames[i] = NULL;
+            if(pDetector->demo_done)
+                continue;
+            ppFrames[i] = get_frame_from_cap(pDetector, NULL, pDetector->countFrame, 0, 0);
+            pDetector->countFrame++;
+            if(!ppFrames[i])
+            {
+                LOGV("stream %d done\n", i);
+                nLive--;
+                continue;
+            }
+            if(!ppFramesPrev[i])
+                init_lanes_for_frame(pDetector, ppFrames[i]);
+            memcpy(pfBatchInput + i*net.inputs, ppFrames[i]->buff_letter.data, net.inputs*sizeof(float));
+            nRead++;
+        }
+        if(!nRead)
+            break;
+
+        prediction = network_predict(net, pfBatchInput);
+
+        for(i = 0; i < nModels; i++)
+        {
+            tDetector* pDetector = ppDetectors[i];
+            tFrame* pFrame = ppFrames[i];
+            if(!pFrame)
+                continue;
+            process_detections(pDetector, pFrame, prediction + i*l.outputs);
+            show_detections(pDetector, pFrame);
+            if(ppFramesPrev[i])
+            {
+                track_bb_in_frame(ppFramesPrev[i]->pBBs, 
+                    &ppFramesPrev[i]->frameInfoWithCpy, 
+                    &pFrame->frameInfoWithCpy,
+                    &pFrame->pBBs,
+                    pDetector->pLanesInfo);
+                free_frame(pDetector, ppFramesPrev[i]);
+            }
+            fire_bb_callbacks_for_frame(pDetector, pFrame);
+            ppFramesPrev[i] = pFrame;
+        }
+    }
+
+    for(i = 0; i < nModels; i++)
+    {
+        tDetector* pDetector = ppDetectors[i];
+        if(ppFramesPrev[i])
+            free_frame(pDetector, ppFramesPrev[i]);
+        dump_lane_info(pDetector->pLanesInfo);
+        free_lanes_info(pDetector->pLanesInfo);
+        free_ptrs((void**)pDetector->demo_names, pDetector->demo_classes);
+        drain_frame_pool(pDetector);
+        if(pDetector->cap)
+            cvReleaseCapture(&pDetector->cap);
+        free(pDetector);
+    }
+    free(ppFramesPrev);
+    free(ppFrames);
+    free(ppDetectors);
+    free(pfBatchInput);
+    free_network(net);
+    return 0;
+}
 #else
 void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, int delay, char *prefix, int avg, float hier, int w, int h, int frames, int fullscreen)
 {
     fLOGD(stderr, "Demo needs OpenCV for webcam images.\n");
 }
+
+int run_detector_models(tDetectorModel** apDetectorModels, int nModels)
+{
+    fLOGD(stderr, "Demo needs OpenCV for webcam images.\n");
+    return 1;
+}
 #endif
 
 int run_detector_model(tDetectorModel* apDetectorModel)
@@ -1414,12 +2182,10 @@ static void test_detector_on_img(tDetector* pDetector, char *datacfg, char *cfgf
     alphabet = load_alphabet();
 #endif
     LOGD("DEBUGME\n");
-    network net = parse_network_cfg(cfgfile);
+    network net = load_network(cfgfile, weightfile, 0);
     LOGD("DEBUGME\n");
-    if(weightfile){
-        load_weights(&net, weightfile);
-    }
     set_batch_network(&net, 1);
+    finalize_network_for_inference(&net);
     srand(2222222);
     clock_t time;
     char buff[2560];
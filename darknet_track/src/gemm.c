@@ -1,10 +1,22 @@
 #include "gemm.h"
 #include "utils.h"
 #include "cuda.h"
+#include "thread_pool.h"
+#include "activations.h"
+#include "half.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86_SIMD
+#include <immintrin.h>
+#if defined(__clang__) || (__GNUC__ >= 5)
+#define GEMM_AVX512
+#endif
+#endif
+
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
         float *B, int ldb,
@@ -137,6 +149,483 @@ void gemm_tt(int M, int N, int K, float ALPHA,
     }
 }
 
+/** packed GEMM: C += ALPHA*op(A)*op(B) in KC x NC panels of B and MC x KC panels of A,
+ * each repacked so the micro-kernel streams through them contiguously; ALPHA is folded into
+ * the packed A and the transposes only change how the panels are gathered */
+#define GEMM_MC 96   /**< rows of A per packed block; a multiple of every kernel's MR */
+#define GEMM_KC 256  /**< depth per packed block; an MR x KC and a KC x NR panel stay in L1 */
+#define GEMM_NC 4096 /**< columns of B per packed block; a multiple of every kernel's NR */
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 32
+
+/** C[0:MR, 0:NR] += a * b for one MR x KC panel of A and one KC x NR panel of B */
+typedef void (*tGemmKernel)(int kc, const float *a, const float *b, float *c, int ldc);
+
+typedef struct
+{
+    int mr;
+    int nr;
+    tGemmKernel kernel;
+    const char *name;
+}tGemmImpl;
+
+static void gemm_kernel_4x8(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    float acc[4][8] = {{0}};
+    int p, i, j;
+    for(p = 0; p < kc; ++p){
+        for(i = 0; i < 4; ++i){
+            for(j = 0; j < 8; ++j){
+                acc[i][j] += a[i]*b[j];
+            }
+        }
+        a += 4;
+        b += 8;
+    }
+    for(i = 0; i < 4; ++i){
+        for(j = 0; j < 8; ++j){
+            c[i*ldc + j] += acc[i][j];
+        }
+    }
+}
+
+#ifdef GEMM_X86_SIMD
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2_6x16(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    __m256 b0, b1, ar;
+    int p;
+    for(p = 0; p < kc; ++p){
+        b0 = _mm256_load_ps(b);
+        b1 = _mm256_load_ps(b + 8);
+        ar = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(ar, b0, c00); c01 = _mm256_fmadd_ps(ar, b1, c01);
+        ar = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(ar, b0, c10); c11 = _mm256_fmadd_ps(ar, b1, c11);
+        ar = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(ar, b0, c20); c21 = _mm256_fmadd_ps(ar, b1, c21);
+        ar = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(ar, b0, c30); c31 = _mm256_fmadd_ps(ar, b1, c31);
+        ar = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(ar, b0, c40); c41 = _mm256_fmadd_ps(ar, b1, c41);
+        ar = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(ar, b0, c50); c51 = _mm256_fmadd_ps(ar, b1, c51);
+        a += 6;
+        b += 16;
+    }
+#define GEMM_AVX2_STORE_ROW(r, lo, hi) \
+    _mm256_storeu_ps(c + r*ldc,     _mm256_add_ps(_mm256_loadu_ps(c + r*ldc),     lo)); \
+    _mm256_storeu_ps(c + r*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + r*ldc + 8), hi))
+    GEMM_AVX2_STORE_ROW(0, c00, c01);
+    GEMM_AVX2_STORE_ROW(1, c10, c11);
+    GEMM_AVX2_STORE_ROW(2, c20, c21);
+    GEMM_AVX2_STORE_ROW(3, c30, c31);
+    GEMM_AVX2_STORE_ROW(4, c40, c41);
+    GEMM_AVX2_STORE_ROW(5, c50, c51);
+#undef GEMM_AVX2_STORE_ROW
+}
+
+#ifdef GEMM_AVX512
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512_6x32(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+    __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+    __m512 b0, b1, ar;
+    int p;
+    for(p = 0; p < kc; ++p){
+        b0 = _mm512_load_ps(b);
+        b1 = _mm512_load_ps(b + 16);
+        ar = _mm512_set1_ps(a[0]); c00 = _mm512_fmadd_ps(ar, b0, c00); c01 = _mm512_fmadd_ps(ar, b1, c01);
+        ar = _mm512_set1_ps(a[1]); c10 = _mm512_fmadd_ps(ar, b0, c10); c11 = _mm512_fmadd_ps(ar, b1, c11);
+        ar = _mm512_set1_ps(a[2]); c20 = _mm512_fmadd_ps(ar, b0, c20); c21 = _mm512_fmadd_ps(ar, b1, c21);
+        ar = _mm512_set1_ps(a[3]); c30 = _mm512_fmadd_ps(ar, b0, c30); c31 = _mm512_fmadd_ps(ar, b1, c31);
+        ar = _mm512_set1_ps(a[4]); c40 = _mm512_fmadd_ps(ar, b0, c40); c41 = _mm512_fmadd_ps(ar, b1, c41);
+        ar = _mm512_set1_ps(a[5]); c50 = _mm512_fmadd_ps(ar, b0, c50); c51 = _mm512_fmadd_ps(ar, b1, c51);
+        a += 6;
+        b += 32;
+    }
+#define GEMM_AVX512_STORE_ROW(r, lo, hi) \
+    _mm512_storeu_ps(c + r*ldc,      _mm512_add_ps(_mm512_loadu_ps(c + r*ldc),      lo)); \
+    _mm512_storeu_ps(c + r*ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + r*ldc + 16), hi))
+    GEMM_AVX512_STORE_ROW(0, c00, c01);
+    GEMM_AVX512_STORE_ROW(1, c10, c11);
+    GEMM_AVX512_STORE_ROW(2, c20, c21);
+    GEMM_AVX512_STORE_ROW(3, c30, c31);
+    GEMM_AVX512_STORE_ROW(4, c40, c41);
+    GEMM_AVX512_STORE_ROW(5, c50, c51);
+#undef GEMM_AVX512_STORE_ROW
+}
+#endif
+#endif
+
+static const tGemmImpl *gemm_select_impl()
+{
+    static const tGemmImpl scalar = {4, 8, gemm_kernel_4x8, "scalar"};
+#ifdef GEMM_X86_SIMD
+    static const tGemmImpl avx2 = {6, 16, gemm_kernel_avx2_6x16, "avx2"};
+#ifdef GEMM_AVX512
+    static const tGemmImpl avx512 = {6, 32, gemm_kernel_avx512_6x32, "avx512"};
+#endif
+    __builtin_cpu_init();
+#ifdef GEMM_AVX512
+    if(__builtin_cpu_supports("avx512f")) return &avx512;
+#endif
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return &avx2;
+#endif
+    return &scalar;
+}
+
+/** CPUID is checked once per process */
+static const tGemmImpl *gemm_impl()
+{
+    static const tGemmImpl *impl = 0;
+    if(!impl) impl = gemm_select_impl();
+    return impl;
+}
+
+/** where the packed GEMM gathers op(A) from: a plain matrix, one stored as half (never
+ * transposed), or the im2col matrix of an NHWC image with one output pixel per row */
+typedef struct {
+    int TA;
+    float *A;
+    unsigned short *A_half;
+    int lda;
+    float *im;          /**< non zero for the implicit NHWC im2col(im) */
+    int c, h, w;
+    int size, stride, pad;
+    int out_w;
+} gemm_a_src;
+
+/** mc x kc block of ALPHA*op(A) at (i0, k0) as MR-row panels, k-major; rows past mc are zero.
+ * Half rows are widened here, a row segment at a time */
+static void gemm_pack_A(const gemm_a_src *src, int mc, int kc, float ALPHA, int i0, int k0, int mr, float *pack)
+{
+    int i, k, r;
+    float *A = src->A;
+    int lda = src->lda;
+    if(src->A_half){
+        float row[GEMM_KC];
+        for(i = 0; i < mc; i += mr){
+            int rows = (mc - i < mr) ? mc - i : mr;
+            for(r = 0; r < mr; ++r){
+                if(r < rows) half_to_float_array(src->A_half + (size_t)(i0 + i + r)*lda + k0, kc, row);
+                for(k = 0; k < kc; ++k) pack[k*mr + r] = (r < rows) ? ALPHA*row[k] : 0;
+            }
+            pack += kc*mr;
+        }
+        return;
+    }
+    for(i = 0; i < mc; i += mr){
+        int rows = (mc - i < mr) ? mc - i : mr;
+        for(k = 0; k < kc; ++k){
+            for(r = 0; r < rows; ++r){
+                int ii = i0 + i + r;
+                int kk = k0 + k;
+                pack[r] = ALPHA*(src->TA ? A[kk*lda + ii] : A[ii*lda + kk]);
+            }
+            for(; r < mr; ++r) pack[r] = 0;
+            pack += mr;
+        }
+    }
+}
+
+/** as gemm_pack_A() with A = im2col of an NHWC image: row i is an output pixel, column k is
+ * (kernel row, kernel col, channel), so each kernel tap is a contiguous run of channels */
+static void gemm_pack_A_im2col_nhwc(const gemm_a_src *src, int mc, int kc, int i0, int k0, int mr, float *pack)
+{
+    int i, k, r, t;
+    int c = src->c;
+    for(i = 0; i < mc; i += mr){
+        int rows = (mc - i < mr) ? mc - i : mr;
+        int ys[GEMM_MAX_MR], xs[GEMM_MAX_MR];
+        for(r = 0; r < rows; ++r){
+            ys[r] = ((i0 + i + r) / src->out_w)*src->stride - src->pad;
+            xs[r] = ((i0 + i + r) % src->out_w)*src->stride - src->pad;
+        }
+        for(k = 0; k < kc; ){
+            int kk = k0 + k;
+            int tap = kk / c;
+            int ch = kk % c;
+            int len = (c - ch < kc - k) ? c - ch : kc - k;
+            int kh = tap / src->size;
+            int kw = tap % src->size;
+            float *dst = pack + k*mr;
+            for(r = 0; r < rows; ++r){
+                int y = ys[r] + kh;
+                int x = xs[r] + kw;
+                if(y < 0 || x < 0 || y >= src->h || x >= src->w){
+                    for(t = 0; t < len; ++t) dst[t*mr + r] = 0;
+                } else {
+                    float *in = src->im + ((size_t)y*src->w + x)*c + ch;
+                    for(t = 0; t < len; ++t) dst[t*mr + r] = in[t];
+                }
+            }
+            for(; r < mr; ++r){
+                for(t = 0; t < len; ++t) dst[t*mr + r] = 0;
+            }
+            k += len;
+        }
+        pack += kc*mr;
+    }
+}
+
+/** where the packed GEMM gathers op(B) from: a plain matrix, or the im2col matrix of
+ * an image, which is then never materialized (implicit GEMM) */
+typedef struct {
+    int TB;
+    float *B;
+    int ldb;
+    float *im;          /**< non zero for the implicit im2col(im) */
+    int c, h, w;
+    int size, stride, pad;
+    int out_w;
+} gemm_b_src;
+
+/** kc x nc block of op(B) at (k0, j0) as NR-column panels, k-major; columns past nc are zero */
+static void gemm_pack_B(const gemm_b_src *src, int kc, int nc, int k0, int j0, int nr, float *pack)
+{
+    int j, k, c;
+    float *B = src->B;
+    int ldb = src->ldb;
+    for(j = 0; j < nc; j += nr){
+        int cols = (nc - j < nr) ? nc - j : nr;
+        for(k = 0; k < kc; ++k){
+            int kk = k0 + k;
+            if(!src->TB && cols == nr){
+                memcpy(pack, B + kk*ldb + j0 + j, nr*sizeof(float));
+            } else {
+                for(c = 0; c < cols; ++c){
+                    int jj = j0 + j + c;
+                    pack[c] = src->TB ? B[jj*ldb + kk] : B[kk*ldb + jj];
+                }
+                for(; c < nr; ++c) pack[c] = 0;
+            }
+            pack += nr;
+        }
+    }
+}
+
+/** as gemm_pack_B() with B = im2col(im): row k is (channel, kernel row, kernel col), column j is
+ * an output pixel; padding reads as zero */
+static void gemm_pack_B_im2col(const gemm_b_src *src, int kc, int nc, int k0, int j0, int nr, float *pack)
+{
+    int rows[GEMM_MAX_NR];
+    int cols[GEMM_MAX_NR];
+    int j, k, c;
+    int ksize = src->size;
+    int out_w = src->out_w;
+    for(j = 0; j < nc; j += nr){
+        int ncols = (nc - j < nr) ? nc - j : nr;
+        /** the panel's output pixels all sit on one output row in the common case */
+        int same_row = ((j0 + j) / out_w) == ((j0 + j + ncols - 1) / out_w);
+        for(c = 0; c < ncols; ++c){
+            rows[c] = ((j0 + j + c) / out_w)*src->stride - src->pad;
+            cols[c] = ((j0 + j + c) % out_w)*src->stride - src->pad;
+        }
+        for(k = 0; k < kc; ++k){
+            int kk = k0 + k;
+            int kw = kk % ksize;
+            int kh = (kk / ksize) % ksize;
+            int ch = kk / ksize / ksize;
+            float *plane = src->im + ch*src->h*src->w;
+            int row0 = rows[0] + kh;
+            int col0 = cols[0] + kw;
+            if(same_row && src->stride == 1 && ncols == nr
+                    && row0 >= 0 && row0 < src->h && col0 >= 0 && col0 + nr <= src->w){
+                memcpy(pack, plane + row0*src->w + col0, nr*sizeof(float));
+            } else {
+                for(c = 0; c < ncols; ++c){
+                    int row = rows[c] + kh;
+                    int col = cols[c] + kw;
+                    pack[c] = (row < 0 || col < 0 || row >= src->h || col >= src->w) ? 0 : plane[row*src->w + col];
+                }
+                for(; c < nr; ++c) pack[c] = 0;
+            }
+            pack += nr;
+        }
+    }
+}
+
+/** what happens to a micro tile of C around the multiply */
+typedef struct {
+    int overwrite;              /**< C is write-only: the first K block stores instead of accumulating */
+    float *bias;                /**< per-row bias added after the last K block, or 0 */
+    int bias_cols;              /**< the bias is per column instead (NHWC outputs) */
+    ACTIVATION activation;      /**< applied after the last K block when bias is set */
+} gemm_epilogue;
+
+/** bias + activation on a rows x cols block of C that was just finished (and is still in L1) */
+static void gemm_apply_epilogue(const gemm_epilogue *ep, int row0, int col0, float *c, int ldc, int rows, int cols)
+{
+    int i, j;
+    if(ep->bias_cols){
+        const float *b = ep->bias + col0;
+        for(i = 0; i < rows; ++i){
+            float *x = c + i*ldc;
+            if(ep->activation == LEAKY){
+                for(j = 0; j < cols; ++j) x[j] = leaky_activate(x[j] + b[j]);
+            } else {
+                for(j = 0; j < cols; ++j) x[j] = activate(x[j] + b[j], ep->activation);
+            }
+        }
+        return;
+    }
+    for(i = 0; i < rows; ++i){
+        float b = ep->bias[row0 + i];
+        float *x = c + i*ldc;
+        if(ep->activation == LEAKY){
+            for(j = 0; j < cols; ++j) x[j] = leaky_activate(x[j] + b);
+        } else if(ep->activation == LINEAR){
+            for(j = 0; j < cols; ++j) x[j] += b;
+        } else {
+            for(j = 0; j < cols; ++j) x[j] = activate(x[j] + b, ep->activation);
+        }
+    }
+}
+
+/** C[M x N] (+)= ALPHA*op(A)*op(B) where op(A) is rows [ib, ib+M) of asrc and op(B) columns
+ * [jb, jb+N) of bsrc; ep->bias is indexed like this block of C */
+static void gemm_packed(int M, int N, int K, float ALPHA, 
+        const gemm_a_src *asrc, int ib,
+        const gemm_b_src *bsrc, int jb,
+        float *C, int ldc, const gemm_epilogue *ep)
+{
+    const tGemmImpl *impl = gemm_impl();
+    int mr = impl->mr;
+    int nr = impl->nr;
+    float *packA = 0;
+    float *packB = 0;
+    float edge[GEMM_MAX_MR*GEMM_MAX_NR];
+    int jc, pc, ic, jr, ir, i, j;
+
+    if(posix_memalign((void **)&packA, 64, GEMM_MC*GEMM_KC*sizeof(float))
+            || posix_memalign((void **)&packB, 64, GEMM_KC*(GEMM_NC + GEMM_MAX_NR)*sizeof(float))){
+        error("gemm: out of memory");
+    }
+    for(jc = 0; jc < N; jc += GEMM_NC){
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for(pc = 0; pc < K; pc += GEMM_KC){
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            if(bsrc->im) gemm_pack_B_im2col(bsrc, kc, nc, pc, jb + jc, nr, packB);
+            else gemm_pack_B(bsrc, kc, nc, pc, jb + jc, nr, packB);
+            int first = ep->overwrite && pc == 0;
+            int last = ep->bias && pc + kc >= K;
+            for(ic = 0; ic < M; ic += GEMM_MC){
+                int mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                if(asrc->im) gemm_pack_A_im2col_nhwc(asrc, mc, kc, ib + ic, pc, mr, packA);
+                else gemm_pack_A(asrc, mc, kc, ALPHA, ib + ic, pc, mr, packA);
+                for(jr = 0; jr < nc; jr += nr){
+                    int cols = (nc - jr < nr) ? nc - jr : nr;
+                    for(ir = 0; ir < mc; ir += mr){
+                        int rows = (mc - ir < mr) ? mc - ir : mr;
+                        float *c = C + (ic + ir)*ldc + jc + jr;
+                        if(rows == mr && cols == nr){
+                            if(first){
+                                for(i = 0; i < rows; ++i) memset(c + i*ldc, 0, cols*sizeof(float));
+                            }
+                            impl->kernel(kc, packA + ir*kc, packB + jr*kc, c, ldc);
+                        } else {
+                            /** partial tile: the panels are zero padded, so run it full size on the side */
+                            memset(edge, 0, mr*nr*sizeof(float));
+                            impl->kernel(kc, packA + ir*kc, packB + jr*kc, edge, nr);
+                            for(i = 0; i < rows; ++i){
+                                for(j = 0; j < cols; ++j){
+                                    c[i*ldc + j] = first ? edge[i*nr + j] : c[i*ldc + j] + edge[i*nr + j];
+                                }
+                            }
+                        }
+                        if(last) gemm_apply_epilogue(ep, ic + ir, jc + jr, c, ldc, rows, cols);
+                    }
+                }
+            }
+        }
+    }
+    free(packA);
+    free(packB);
+}
+
+/** with a thread pool, a gemm_cpu() is split into bm x bn tiles of C */
+#define GEMM_MIN_PARALLEL_WORK (1 << 20) /**< multiply-adds below which one thread does it all */
+
+typedef struct {
+    int M, N, K;
+    float ALPHA, BETA;
+    gemm_a_src A;
+    gemm_b_src B;
+    float *C; int ldc;
+    float *bias;
+    int bias_cols;
+    ACTIVATION activation;
+    int col0;                   /**< first column of op(B) this C starts at */
+    int bm, bn;
+    int tiles_n;
+} gemm_tile_args;
+
+static void gemm_tiles(void *ptr, int start, int end)
+{
+    gemm_tile_args *a = (gemm_tile_args *)ptr;
+    int t, i, j;
+    for(t = start; t < end; ++t){
+        int i0 = (t / a->tiles_n)*a->bm;
+        int j0 = (t % a->tiles_n)*a->bn;
+        int m = (a->M - i0 < a->bm) ? a->M - i0 : a->bm;
+        int n = (a->N - j0 < a->bn) ? a->N - j0 : a->bn;
+        float *c = a->C + i0*a->ldc + j0;
+        gemm_epilogue ep;
+        ep.overwrite = a->BETA == 0 && a->K > 0;
+        ep.bias = a->bias ? a->bias + (a->bias_cols ? j0 : i0) : 0;
+        ep.bias_cols = a->bias_cols;
+        ep.activation = a->activation;
+        if(a->BETA == 0 && a->K <= 0){
+            for(i = 0; i < m; ++i) memset(c + i*a->ldc, 0, n*sizeof(float));
+        } else if(a->BETA != 0 && a->BETA != 1){
+            for(i = 0; i < m; ++i){
+                for(j = 0; j < n; ++j){
+                    c[i*a->ldc + j] *= a->BETA;
+                }
+            }
+        }
+        if(a->K <= 0){
+            if(ep.bias) gemm_apply_epilogue(&ep, 0, 0, c, a->ldc, m, n);
+            continue;
+        }
+        gemm_packed(m, n, a->K, a->ALPHA,
+                &a->A, i0,
+                &a->B, a->col0 + j0,
+                c, a->ldc, &ep);
+    }
+}
+
+static void gemm_run_tiles(gemm_tile_args *args)
+{
+    int M = args->M;
+    int N = args->N;
+    int threads = get_cpu_threads();
+    if(M <= 0 || N <= 0) return;
+    args->bm = M;
+    args->bn = N;
+    if(threads > 1 && (double)M*N*args->K >= GEMM_MIN_PARALLEL_WORK){
+        /** each tile packs its own rows of A and columns of B, so the grid is shaped to keep
+         * M*tiles_n + N*tiles_m (the packing) small for the number of tiles */
+        int tiles = 2*threads;
+        int tiles_m = (int)(sqrt((double)tiles*M/N) + .5);
+        int tiles_n;
+        if(tiles_m < 1) tiles_m = 1;
+        if(tiles_m > tiles) tiles_m = tiles;
+        tiles_n = (tiles + tiles_m - 1)/tiles_m;
+        args->bm = (M + tiles_m - 1)/tiles_m;
+        args->bm = (args->bm + 11)/12*12;
+        args->bn = (N + tiles_n - 1)/tiles_n;
+        args->bn = (args->bn + GEMM_MAX_NR - 1)/GEMM_MAX_NR*GEMM_MAX_NR;
+    }
+    args->tiles_n = (N + args->bn - 1)/args->bn;
+    parallel_for(((M + args->bm - 1)/args->bm)*args->tiles_n, 1, gemm_tiles, args);
+}
 
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
@@ -145,20 +634,168 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float *C, int ldc)
 {
     //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
-    int i, j;
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA;
-        }
+    gemm_tile_args args;
+    memset(&args, 0, sizeof(args));
+    args.M = M; args.N = N; args.K = K;
+    args.ALPHA = ALPHA; args.BETA = BETA;
+    args.A.TA = TA; args.A.A = A; args.A.lda = lda;
+    args.B.TB = TB; args.B.B = B; args.B.ldb = ldb;
+    args.C = C; args.ldc = ldc;
+    gemm_run_tiles(&args);
+}
+
+/** C[M x N] = activation(A*B + bias), bias per row; the bias and activation are applied to
+ * each tile of C as it is finished rather than in extra passes over C */
+void gemm_bias_act_cpu(int M, int N, int K,
+        float *A, int lda,
+        float *B, int ldb,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc)
+{
+    gemm_tile_args args;
+    memset(&args, 0, sizeof(args));
+    args.M = M; args.N = N; args.K = K;
+    args.ALPHA = 1; args.BETA = 0;
+    args.A.A = A; args.A.lda = lda;
+    args.B.B = B; args.B.ldb = ldb;
+    args.C = C; args.ldc = ldc;
+    args.bias = bias;
+    args.activation = activation;
+    gemm_run_tiles(&args);
+}
+
+static void gemm_im2col_args(gemm_tile_args *args, int M, float *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *C, int ldc)
+{
+    int out_h = (h + 2*pad - size)/stride + 1;
+    int out_w = (w + 2*pad - size)/stride + 1;
+    memset(args, 0, sizeof(*args));
+    args->M = M; args->N = out_h*out_w; args->K = c*size*size;
+    args->ALPHA = 1; args->BETA = 1;
+    args->A.A = A; args->A.lda = lda;
+    args->B.im = im;
+    args->B.c = c; args->B.h = h; args->B.w = w;
+    args->B.size = size; args->B.stride = stride; args->B.pad = pad;
+    args->B.out_w = out_w;
+    args->C = C; args->ldc = ldc;
+}
+
+/**
+ * C[M x out_h*out_w] += A * im2col(im) with A being M x (c*size*size) row-major, packing the
+ * im2col panels straight from im instead of expanding the whole matrix first
+ */
+void gemm_im2col_cpu(int M, float *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *C, int ldc)
+{
+    gemm_tile_args args;
+    gemm_im2col_args(&args, M, A, lda, im, c, h, w, size, stride, pad, C, ldc);
+    gemm_run_tiles(&args);
+}
+
+/** C = activation(A * im2col(im) + bias), the convolution with its epilogue fused */
+void gemm_im2col_bias_act_cpu(int M, float *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc)
+{
+    gemm_tile_args args;
+    gemm_im2col_args(&args, M, A, lda, im, c, h, w, size, stride, pad, C, ldc);
+    args.BETA = 0;
+    args.bias = bias;
+    args.activation = activation;
+    gemm_run_tiles(&args);
+}
+
+/** columns [j0, j0 + n) of gemm_im2col_bias_act_cpu(), e.g. a band of output rows, into C */
+void gemm_im2col_band_bias_act_cpu(int M, float *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        int j0, int n,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc)
+{
+    gemm_tile_args args;
+    gemm_im2col_args(&args, M, A, lda, im, c, h, w, size, stride, pad, C, ldc);
+    args.N = n;
+    args.col0 = j0;
+    args.BETA = 0;
+    args.bias = bias;
+    args.activation = activation;
+    gemm_run_tiles(&args);
+}
+
+/** gemm_bias_act_cpu() with A stored as half */
+void gemm_half_bias_act_cpu(int M, int N, int K,
+        unsigned short *A, int lda,
+        float *B, int ldb,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc)
+{
+    gemm_tile_args args;
+    memset(&args, 0, sizeof(args));
+    args.M = M; args.N = N; args.K = K;
+    args.ALPHA = 1; args.BETA = 0;
+    args.A.A_half = A; args.A.lda = lda;
+    args.B.B = B; args.B.ldb = ldb;
+    args.C = C; args.ldc = ldc;
+    args.bias = bias;
+    args.activation = activation;
+    gemm_run_tiles(&args);
+}
+
+/** gemm_im2col_bias_act_cpu() with A stored as half */
+void gemm_im2col_half_bias_act_cpu(int M, unsigned short *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc)
+{
+    gemm_tile_args args;
+    gemm_im2col_args(&args, M, 0, lda, im, c, h, w, size, stride, pad, C, ldc);
+    args.A.A_half = A;
+    args.BETA = 0;
+    args.bias = bias;
+    args.activation = activation;
+    gemm_run_tiles(&args);
+}
+
+/**
+ * The convolution of an NHWC image: C[out_h*out_w x M] = activation(im2col(im) * A^T + bias), so
+ * C is NHWC too. A is M x (size*size*c) with each filter in (kernel row, kernel col, channel)
+ * order; the im2col panels are gathered straight from im as for gemm_im2col_cpu()
+ */
+void gemm_nhwc_conv_bias_act_cpu(int M, float *A,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *bias, ACTIVATION activation,
+        float *C)
+{
+    gemm_tile_args args;
+    int out_h = (h + 2*pad - size)/stride + 1;
+    int out_w = (w + 2*pad - size)/stride + 1;
+    memset(&args, 0, sizeof(args));
+    args.M = out_h*out_w; args.N = M; args.K = size*size*c;
+    args.ALPHA = 1; args.BETA = 0;
+    if(size == 1 && stride == 1 && pad == 0){
+        /** im2col of a 1x1 conv is the image itself */
+        args.A.A = im; args.A.lda = c;
+    } else {
+        args.A.im = im;
+        args.A.c = c; args.A.h = h; args.A.w = w;
+        args.A.size = size; args.A.stride = stride; args.A.pad = pad;
+        args.A.out_w = out_w;
     }
-    if(!TA && !TB)
-        gemm_nn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
-    else if(TA && !TB)
-        gemm_tn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
-    else if(!TA && TB)
-        gemm_nt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
-    else
-        gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
+    args.B.TB = 1; args.B.B = A; args.B.ldb = args.K;
+    args.C = C; args.ldc = M;
+    args.bias = bias;
+    args.bias_cols = 1;
+    args.activation = activation;
+    gemm_run_tiles(&args);
 }
 
 #ifdef GPU
@@ -1,6 +1,8 @@
 #ifndef GEMM_H
 #define GEMM_H
 
+#include "darknet.h"
+
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
         float *B, int ldb,
@@ -18,6 +20,48 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+void gemm_im2col_cpu(int M, float *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *C, int ldc);
+
+void gemm_bias_act_cpu(int M, int N, int K,
+        float *A, int lda,
+        float *B, int ldb,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc);
+
+void gemm_im2col_bias_act_cpu(int M, float *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc);
+
+void gemm_im2col_band_bias_act_cpu(int M, float *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        int j0, int n,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc);
+
+void gemm_half_bias_act_cpu(int M, int N, int K,
+        unsigned short *A, int lda,
+        float *B, int ldb,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc);
+
+void gemm_im2col_half_bias_act_cpu(int M, unsigned short *A, int lda,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *bias, ACTIVATION activation,
+        float *C, int ldc);
+
+void gemm_nhwc_conv_bias_act_cpu(int M, float *A,
+        float *im, int c, int h, int w,
+        int size, int stride, int pad,
+        float *bias, ACTIVATION activation,
+        float *C);
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
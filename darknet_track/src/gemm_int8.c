@@ -0,0 +1,460 @@
+#include "gemm_int8.h"
+#include "thread_pool.h"
+#include "activations.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ >= 8))
+#define GEMM_INT8_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * INT8 convolution as a GEMM. Both operands come in 4-byte groups along K: four u8 x s8
+ * products for AVX512-VNNI dpbusd, or two s16 x s16 products for AVX2 madd_epi16 (and the
+ * scalar fallback). A K group is KG consecutive channels at one (kh, kw) tap, and the input is
+ * quantized straight into that channel-blocked layout (4 bytes per pixel per channel block), so
+ * packing the im2col panels is row memcpys. The weights are packed once at load in blocks of
+ * GEMM_INT8_KG groups, so a block of A stays in L2 while the B panels stream past it; int32
+ * partial sums live in a per-thread tile between K blocks.
+ */
+
+/** K groups per block of A and B */
+#define GEMM_INT8_KG 128
+/** bytes of a packed B column block (all of K) */
+#define GEMM_INT8_B_BYTES (1024*1024)
+#define GEMM_INT8_MAX_NR 32
+
+typedef struct {
+    int mr, nr;
+    int kg;             /**< channels per 4-byte group */
+    int zero_point;     /**< what the inputs are biased by; also the byte that encodes a zero input */
+    void (*kernel)(int groups, const signed char *a, const unsigned char *b, int *c, int ldc);
+    const char *name;
+} tGemmInt8Impl;
+
+static inline int load_group(const void *p)
+{
+    int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/** c[4 x 8] += a . b over s16 pairs */
+static void gemm_int8_kernel_4x8(int groups, const signed char *a, const unsigned char *b, int *c, int ldc)
+{
+    int acc[4*8] = {0};
+    int g, r, j;
+    for(g = 0; g < groups; ++g){
+        const short *as = (const short *)a;
+        const short *bs = (const short *)b;
+        for(r = 0; r < 4; ++r){
+            int a0 = as[2*r], a1 = as[2*r + 1];
+            for(j = 0; j < 8; ++j){
+                acc[r*8 + j] += a0*bs[2*j] + a1*bs[2*j + 1];
+            }
+        }
+        a += 4*4;
+        b += 8*4;
+    }
+    for(r = 0; r < 4; ++r){
+        for(j = 0; j < 8; ++j) c[r*ldc + j] += acc[r*8 + j];
+    }
+}
+
+#ifdef GEMM_INT8_X86
+/** c[6 x 16] += a . b with madd_epi16: each int32 lane takes two s16 products */
+__attribute__((target("avx2")))
+static void gemm_int8_kernel_avx2_6x16(int groups, const signed char *a, const unsigned char *b, int *c, int ldc)
+{
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+    __m256i c40 = _mm256_setzero_si256(), c41 = _mm256_setzero_si256();
+    __m256i c50 = _mm256_setzero_si256(), c51 = _mm256_setzero_si256();
+    __m256i b0, b1, ar;
+    int g;
+    for(g = 0; g < groups; ++g){
+        b0 = _mm256_loadu_si256((const __m256i *)b);
+        b1 = _mm256_loadu_si256((const __m256i *)(b + 32));
+#define GEMM_INT8_AVX2_ROW(r, lo, hi) \
+        ar = _mm256_set1_epi32(load_group(a + 4*r)); \
+        lo = _mm256_add_epi32(lo, _mm256_madd_epi16(ar, b0)); \
+        hi = _mm256_add_epi32(hi, _mm256_madd_epi16(ar, b1))
+        GEMM_INT8_AVX2_ROW(0, c00, c01);
+        GEMM_INT8_AVX2_ROW(1, c10, c11);
+        GEMM_INT8_AVX2_ROW(2, c20, c21);
+        GEMM_INT8_AVX2_ROW(3, c30, c31);
+        GEMM_INT8_AVX2_ROW(4, c40, c41);
+        GEMM_INT8_AVX2_ROW(5, c50, c51);
+#undef GEMM_INT8_AVX2_ROW
+        a += 6*4;
+        b += 16*4;
+    }
+#define GEMM_INT8_AVX2_STORE(r, lo, hi) \
+    _mm256_storeu_si256((__m256i *)(c + r*ldc), \
+            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(c + r*ldc)), lo)); \
+    _mm256_storeu_si256((__m256i *)(c + r*ldc + 8), \
+            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(c + r*ldc + 8)), hi))
+    GEMM_INT8_AVX2_STORE(0, c00, c01);
+    GEMM_INT8_AVX2_STORE(1, c10, c11);
+    GEMM_INT8_AVX2_STORE(2, c20, c21);
+    GEMM_INT8_AVX2_STORE(3, c30, c31);
+    GEMM_INT8_AVX2_STORE(4, c40, c41);
+    GEMM_INT8_AVX2_STORE(5, c50, c51);
+#undef GEMM_INT8_AVX2_STORE
+}
+
+/** c[8 x 32] += a . b with dpbusd: each int32 lane takes four u8 (input) x s8 (weight) products */
+__attribute__((target("avx512f,avx512vnni")))
+static void gemm_int8_kernel_vnni_8x32(int groups, const signed char *a, const unsigned char *b, int *c, int ldc)
+{
+#define GEMM_INT8_VNNI_LOAD(r, lo, hi) \
+    __m512i lo = _mm512_loadu_si512((const void *)(c + r*ldc)); \
+    __m512i hi = _mm512_loadu_si512((const void *)(c + r*ldc + 16))
+    GEMM_INT8_VNNI_LOAD(0, c00, c01);
+    GEMM_INT8_VNNI_LOAD(1, c10, c11);
+    GEMM_INT8_VNNI_LOAD(2, c20, c21);
+    GEMM_INT8_VNNI_LOAD(3, c30, c31);
+    GEMM_INT8_VNNI_LOAD(4, c40, c41);
+    GEMM_INT8_VNNI_LOAD(5, c50, c51);
+    GEMM_INT8_VNNI_LOAD(6, c60, c61);
+    GEMM_INT8_VNNI_LOAD(7, c70, c71);
+#undef GEMM_INT8_VNNI_LOAD
+    __m512i b0, b1, ar;
+    int g;
+    for(g = 0; g < groups; ++g){
+        b0 = _mm512_loadu_si512((const void *)b);
+        b1 = _mm512_loadu_si512((const void *)(b + 64));
+#define GEMM_INT8_VNNI_ROW(r, lo, hi) \
+        ar = _mm512_set1_epi32(load_group(a + 4*r)); \
+        lo = _mm512_dpbusd_epi32(lo, b0, ar); \
+        hi = _mm512_dpbusd_epi32(hi, b1, ar)
+        GEMM_INT8_VNNI_ROW(0, c00, c01);
+        GEMM_INT8_VNNI_ROW(1, c10, c11);
+        GEMM_INT8_VNNI_ROW(2, c20, c21);
+        GEMM_INT8_VNNI_ROW(3, c30, c31);
+        GEMM_INT8_VNNI_ROW(4, c40, c41);
+        GEMM_INT8_VNNI_ROW(5, c50, c51);
+        GEMM_INT8_VNNI_ROW(6, c60, c61);
+        GEMM_INT8_VNNI_ROW(7, c70, c71);
+#undef GEMM_INT8_VNNI_ROW
+        a += 8*4;
+        b += 32*4;
+    }
+#define GEMM_INT8_VNNI_STORE(r, lo, hi) \
+    _mm512_storeu_si512((void *)(c + r*ldc), lo); \
+    _mm512_storeu_si512((void *)(c + r*ldc + 16), hi)
+    GEMM_INT8_VNNI_STORE(0, c00, c01);
+    GEMM_INT8_VNNI_STORE(1, c10, c11);
+    GEMM_INT8_VNNI_STORE(2, c20, c21);
+    GEMM_INT8_VNNI_STORE(3, c30, c31);
+    GEMM_INT8_VNNI_STORE(4, c40, c41);
+    GEMM_INT8_VNNI_STORE(5, c50, c51);
+    GEMM_INT8_VNNI_STORE(6, c60, c61);
+    GEMM_INT8_VNNI_STORE(7, c70, c71);
+#undef GEMM_INT8_VNNI_STORE
+}
+#endif
+
+static const tGemmInt8Impl *gemm_int8_select_impl()
+{
+    static const tGemmInt8Impl scalar = {4, 8, 2, 0, gemm_int8_kernel_4x8, "scalar"};
+#ifdef GEMM_INT8_X86
+    static const tGemmInt8Impl avx2 = {6, 16, 2, 0, gemm_int8_kernel_avx2_6x16, "avx2"};
+    static const tGemmInt8Impl vnni = {8, 32, 4, 128, gemm_int8_kernel_vnni_8x32, "avx512vnni"};
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512vnni")) return &vnni;
+    if(__builtin_cpu_supports("avx2")) return &avx2;
+#endif
+    return &scalar;
+}
+
+/** CPUID is checked once per process; packed weights are only valid for the impl that packed them */
+static const tGemmInt8Impl *gemm_int8_impl()
+{
+    static const tGemmInt8Impl *impl = 0;
+    if(!impl) impl = gemm_int8_select_impl();
+    return impl;
+}
+
+/** channel blocks of the input; K groups are (block, kh, kw) */
+static int gemm_int8_blocks(const tGemmInt8Impl *impl, int c)
+{
+    return (c + impl->kg - 1)/impl->kg;
+}
+
+size_t gemm_int8_input_size(int c, int h, int w)
+{
+    return (size_t)gemm_int8_blocks(gemm_int8_impl(), c)*h*w*4;
+}
+
+typedef struct {
+    const float *x;
+    int c, hw;
+    float scale;
+    unsigned char *q;
+} gemm_int8_quantize_args;
+
+static void gemm_int8_quantize_range(void *ptr, int start, int end)
+{
+    gemm_int8_quantize_args *a = (gemm_int8_quantize_args *)ptr;
+    const tGemmInt8Impl *impl = gemm_int8_impl();
+    int esize = 4/impl->kg;
+    int cb, k, p;
+    for(cb = start; cb < end; ++cb){
+        for(k = 0; k < impl->kg; ++k){
+            int ch = cb*impl->kg + k;
+            unsigned char *dst = a->q + (size_t)cb*a->hw*4 + k*esize;
+            const float *src = a->x + (size_t)ch*a->hw;
+            for(p = 0; p < a->hw; ++p, dst += 4){
+                int v = 0;
+                if(ch < a->c){
+                    float f = src[p]*a->scale;
+                    v = (int)(f + (f >= 0 ? .5f : -.5f));
+                    v = (v > 127) ? 127 : (v < -127) ? -127 : v;
+                }
+                if(esize == 1) *dst = v + 128;
+                else {
+                    short s = v;
+                    memcpy(dst, &s, sizeof(s));
+                }
+            }
+        }
+    }
+}
+
+void gemm_int8_quantize_input(const float *x, int c, int h, int w, float scale, unsigned char *q)
+{
+    gemm_int8_quantize_args a = {x, c, h*w, scale, q};
+    int blocks = gemm_int8_blocks(gemm_int8_impl(), c);
+    parallel_for(blocks, 1, gemm_int8_quantize_range, &a);
+}
+
+size_t gemm_int8_packed_size(int n, int c, int size)
+{
+    const tGemmInt8Impl *impl = gemm_int8_impl();
+    size_t rows = (n + impl->mr - 1)/impl->mr*impl->mr;
+    return rows*gemm_int8_blocks(impl, c)*size*size*4;
+}
+
+/** layout: K blocks of GEMM_INT8_KG groups; within a block, MR-row panels; within a panel,
+ * group-major MR x 4 bytes. Block g0 / panel i starts at (g0*rows + i*count)*4 bytes */
+void gemm_int8_pack_weights(int n, int c, int size, const signed char *W, signed char *packed)
+{
+    const tGemmInt8Impl *impl = gemm_int8_impl();
+    int taps = size*size;
+    int groups = gemm_int8_blocks(impl, c)*taps;
+    int g0, i, g, r, k;
+    for(g0 = 0; g0 < groups; g0 += GEMM_INT8_KG){
+        int count = (groups - g0 < GEMM_INT8_KG) ? groups - g0 : GEMM_INT8_KG;
+        for(i = 0; i < n; i += impl->mr){
+            for(g = g0; g < g0 + count; ++g){
+                int cb = g / taps;
+                int tap = g % taps;
+                for(r = 0; r < impl->mr; ++r){
+                    for(k = 0; k < impl->kg; ++k){
+                        int ch = cb*impl->kg + k;
+                        int v = (i + r < n && ch < c) ? W[((i + r)*c + ch)*taps + tap] : 0;
+                        if(impl->kg == 4) packed[k] = v;
+                        else ((short *)packed)[k] = v;
+                    }
+                    packed += 4;
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    const tGemmInt8Impl *impl;
+    int M, N, groups;
+    const signed char *A;
+    const int *row_sums;
+    const unsigned char *im;
+    int h, w, size, stride, pad, out_w;
+    const float *scales;
+    const float *bias;
+    ACTIVATION activation;
+    float *C;
+    int ldc;
+    int nc, mb;
+    int tiles_m;
+} gemm_int8_args;
+
+/** per-thread B panels (0) and int32 accumulators (1), grown on demand */
+static void *gemm_int8_scratch(int which, size_t bytes)
+{
+    static __thread void *buf[2];
+    static __thread size_t cap[2];
+    if(bytes > cap[which]){
+        free(buf[which]);
+        buf[which] = 0;
+        if(posix_memalign(&buf[which], 64, bytes)) error("gemm_int8: out of memory");
+        cap[which] = bytes;
+    }
+    return buf[which];
+}
+
+/** columns [j0, j0+nc) of im2col(im) as NR-column panels of K groups. Columns are handled as
+ * runs along one output row, which for stride 1 are contiguous pixels of the blocked input;
+ * anything outside the image or past nc packs as a zero input */
+static void gemm_int8_pack_B(const gemm_int8_args *a, int j0, int nc, unsigned char *pack)
+{
+    const tGemmInt8Impl *impl = a->impl;
+    int nr = impl->nr;
+    int ksize = a->size;
+    int taps = ksize*ksize;
+    int zero = impl->zero_point;
+    int run_start[GEMM_INT8_MAX_NR + 1];
+    int run_y[GEMM_INT8_MAX_NR];
+    int run_x[GEMM_INT8_MAX_NR];
+    int jr, g, r, jj;
+    for(jr = 0; jr < nc; jr += nr){
+        int ncols = (nc - jr < nr) ? nc - jr : nr;
+        unsigned char *panel = pack + (size_t)jr*a->groups*4;
+        int runs = 0;
+        for(jj = 0; jj < ncols; ++jj){
+            int col = j0 + jr + jj;
+            int oy = col / a->out_w;
+            if(jj == 0 || oy != (col - 1)/a->out_w){
+                run_start[runs] = jj;
+                run_y[runs] = oy*a->stride - a->pad;
+                run_x[runs] = (col % a->out_w)*a->stride - a->pad;
+                ++runs;
+            }
+        }
+        run_start[runs] = ncols;
+        for(g = 0; g < a->groups; ++g){
+            int kh = (g % taps)/ksize;
+            int kw = g % ksize;
+            const unsigned char *plane = a->im + (size_t)(g / taps)*a->h*a->w*4;
+            unsigned char *dst = panel + (size_t)g*nr*4;
+            for(r = 0; r < runs; ++r){
+                int len = run_start[r + 1] - run_start[r];
+                int y = run_y[r] + kh;
+                int x = run_x[r] + kw;
+                unsigned char *d = dst + run_start[r]*4;
+                if(y < 0 || y >= a->h){
+                    memset(d, zero, len*4);
+                } else if(a->stride == 1){
+                    int left = (x < 0) ? -x : 0;
+                    int right = (x + len > a->w) ? x + len - a->w : 0;
+                    if(left > len) left = len;
+                    if(right > len - left) right = len - left;
+                    memset(d, zero, left*4);
+                    memcpy(d + left*4, plane + ((size_t)y*a->w + x + left)*4, (len - left - right)*4);
+                    memset(d + (len - right)*4, zero, right*4);
+                } else {
+                    for(jj = 0; jj < len; ++jj, x += a->stride){
+                        if(x < 0 || x >= a->w) memset(d + jj*4, zero, 4);
+                        else memcpy(d + jj*4, plane + ((size_t)y*a->w + x)*4, 4);
+                    }
+                }
+            }
+            memset(dst + ncols*4, zero, (nr - ncols)*4);
+        }
+    }
+}
+
+/** int32 sums -> activation(scale*(acc - zero point correction) + bias) into C */
+static void gemm_int8_epilogue(const gemm_int8_args *a, const int *acc, int ldacc, int i0, int j0, int rows, int cols)
+{
+    int r, j;
+    for(r = 0; r < rows; ++r){
+        int i = i0 + r;
+        int corr = a->impl->zero_point*a->row_sums[i];
+        float s = a->scales[i];
+        float b = a->bias[i];
+        float *c = a->C + i*a->ldc + j0;
+        const int *t = acc + r*ldacc;
+        if(a->activation == LEAKY){
+            for(j = 0; j < cols; ++j) c[j] = leaky_activate((t[j] - corr)*s + b);
+        } else {
+            for(j = 0; j < cols; ++j) c[j] = activate((t[j] - corr)*s + b, a->activation);
+        }
+    }
+}
+
+static void gemm_int8_tiles(void *ptr, int start, int end)
+{
+    gemm_int8_args *a = (gemm_int8_args *)ptr;
+    const tGemmInt8Impl *impl = a->impl;
+    int mr = impl->mr, nr = impl->nr;
+    int rows_a = (a->M + mr - 1)/mr*mr;
+    int t, g0, jr, ir;
+    for(t = start; t < end; ++t){
+        int i0 = (t % a->tiles_m)*a->mb;
+        int j0 = (t / a->tiles_m)*a->nc;
+        int mc = (a->M - i0 < a->mb) ? a->M - i0 : a->mb;
+        int nc = (a->N - j0 < a->nc) ? a->N - j0 : a->nc;
+        int ldacc = (nc + nr - 1)/nr*nr;
+        int mc_pad = (mc + mr - 1)/mr*mr;
+        unsigned char *pack = gemm_int8_scratch(0, (size_t)ldacc*a->groups*4);
+        int *acc = gemm_int8_scratch(1, (size_t)mc_pad*ldacc*sizeof(int));
+        gemm_int8_pack_B(a, j0, nc, pack);
+        memset(acc, 0, (size_t)mc_pad*ldacc*sizeof(int));
+        for(g0 = 0; g0 < a->groups; g0 += GEMM_INT8_KG){
+            int count = (a->groups - g0 < GEMM_INT8_KG) ? a->groups - g0 : GEMM_INT8_KG;
+            const signed char *ablock = a->A + (size_t)g0*rows_a*4;
+            for(jr = 0; jr < nc; jr += nr){
+                const unsigned char *bpanel = pack + ((size_t)jr*a->groups + (size_t)g0*nr)*4;
+                for(ir = i0; ir < i0 + mc; ir += mr){
+                    impl->kernel(count, ablock + (size_t)ir*count*4, bpanel,
+                            acc + (ir - i0)*ldacc + jr, ldacc);
+                }
+            }
+        }
+        gemm_int8_epilogue(a, acc, ldacc, i0, j0, mc, nc);
+    }
+}
+
+void gemm_int8_conv_cpu(int n, const signed char *packed, const int *row_sums,
+        const unsigned char *q, int c, int h, int w,
+        int size, int stride, int pad,
+        const float *scales, const float *bias, ACTIVATION activation,
+        float *C, int ldc)
+{
+    gemm_int8_args a;
+    int out_h = (h + 2*pad - size)/stride + 1;
+    int threads = get_cpu_threads();
+    int panels_m, tiles_n;
+    memset(&a, 0, sizeof(a));
+    a.impl = gemm_int8_impl();
+    a.M = n;
+    a.out_w = (w + 2*pad - size)/stride + 1;
+    a.N = out_h*a.out_w;
+    a.groups = gemm_int8_blocks(a.impl, c)*size*size;
+    a.A = packed;
+    a.row_sums = row_sums;
+    a.im = q;
+    a.h = h; a.w = w;
+    a.size = size; a.stride = stride; a.pad = pad;
+    a.scales = scales;
+    a.bias = bias;
+    a.activation = activation;
+    a.C = C;
+    a.ldc = ldc;
+    if(n <= 0 || a.N <= 0) return;
+
+    /** column blocks sized for L2, split further so every thread gets work; rows only split
+     * when the map is too small (13x13) to give each thread columns */
+    a.nc = GEMM_INT8_B_BYTES/(a.groups*4)/a.impl->nr*a.impl->nr;
+    if(a.nc < a.impl->nr) a.nc = a.impl->nr;
+    if(threads > 1 && (a.N + a.nc - 1)/a.nc < 2*threads){
+        a.nc = (a.N + 2*threads - 1)/(2*threads);
+        a.nc = (a.nc + a.impl->nr - 1)/a.impl->nr*a.impl->nr;
+    }
+    tiles_n = (a.N + a.nc - 1)/a.nc;
+    panels_m = (n + a.impl->mr - 1)/a.impl->mr;
+    a.tiles_m = 1;
+    if(threads > 1 && tiles_n < 2*threads){
+        a.tiles_m = (2*threads + tiles_n - 1)/tiles_n;
+        if(a.tiles_m > panels_m) a.tiles_m = panels_m;
+    }
+    a.mb = (panels_m + a.tiles_m - 1)/a.tiles_m*a.impl->mr;
+    a.tiles_m = (n + a.mb - 1)/a.mb;
+    parallel_for(a.tiles_m*tiles_n, 1, gemm_int8_tiles, &a);
+}
@@ -0,0 +1,32 @@
+#ifndef GEMM_INT8_H
+#define GEMM_INT8_H
+
+#include <stddef.h>
+#include "darknet.h"
+
+/** bytes gemm_int8_quantize_input() writes for a c x h x w input */
+size_t gemm_int8_input_size(int c, int h, int w);
+
+/** x (c x h x w) quantized as clamp(round(x*scale), -127, 127) into the channel-blocked layout
+ * gemm_int8_conv_cpu() reads */
+void gemm_int8_quantize_input(const float *x, int c, int h, int w, float scale, unsigned char *q);
+
+/** bytes of the packed form of n int8 filters of c x size x size */
+size_t gemm_int8_packed_size(int n, int c, int size);
+
+/** packs int8 filters W (n x c x size x size, the darknet weight order) once, in the layout the
+ * selected kernel reads */
+void gemm_int8_pack_weights(int n, int c, int size, const signed char *W, signed char *packed);
+
+/**
+ * C[n x out_h*out_w] = activation(scales[i] * (W_i . im2col(x_q)) + bias[i]) where the filters
+ * were packed by gemm_int8_pack_weights() (row_sums[i] = sum of W_i) and q holds x_q from
+ * gemm_int8_quantize_input()
+ */
+void gemm_int8_conv_cpu(int n, const signed char *packed, const int *row_sums,
+        const unsigned char *q, int c, int h, int w,
+        int size, int stride, int pad,
+        const float *scales, const float *bias, ACTIVATION activation,
+        float *C, int ldc);
+
+#endif
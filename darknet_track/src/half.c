@@ -0,0 +1,115 @@
+#include "half.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HALF_X86
+#endif
+
+/** round to nearest even, with overflow to inf and gradual underflow like F16C */
+static unsigned short float_to_half(float f)
+{
+    unsigned int x;
+    memcpy(&x, &f, sizeof(x));
+    unsigned int sign = (x >> 16) & 0x8000;
+    int exp = (x >> 23) & 0xff;
+    unsigned int mant = x & 0x7fffff;
+    if(exp == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+    exp = exp - 127 + 15;
+    if(exp >= 0x1f) return sign | 0x7c00;
+    if(exp <= 0){
+        if(exp < -10) return sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        unsigned int h = mant >> shift;
+        unsigned int rest = mant & ((1u << shift) - 1);
+        unsigned int halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (h & 1))) ++h;
+        return sign | h;
+    }
+    unsigned int h = (exp << 10) | (mant >> 13);
+    unsigned int rest = mant & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (h & 1))) ++h;
+    return sign | h;
+}
+
+static float half_to_float(unsigned short h)
+{
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    unsigned int mant = h & 0x3ff;
+    unsigned int x;
+    float f;
+    if(exp == 0x1f){
+        x = sign | 0x7f800000 | (mant << 13);
+    } else if(exp == 0){
+        if(!mant){
+            x = sign;
+        } else {
+            exp = 1;
+            while(!(mant & 0x400)){
+                mant <<= 1;
+                --exp;
+            }
+            x = sign | ((exp - 15 + 127) << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else {
+        x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    }
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+#ifdef HALF_X86
+__attribute__((target("avx,f16c")))
+static void float_to_half_f16c(const float *src, int n, unsigned short *dst)
+{
+    int i;
+    for(i = 0; i + 8 <= n; i += 8){
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(dst + i), h);
+    }
+    for(; i < n; ++i) dst[i] = float_to_half(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void half_to_float_f16c(const unsigned short *src, int n, float *dst)
+{
+    int i;
+    for(i = 0; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    }
+    for(; i < n; ++i) dst[i] = half_to_float(src[i]);
+}
+
+static int has_f16c()
+{
+    static int f16c = -1;
+    if(f16c < 0) f16c = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+    return f16c;
+}
+#endif
+
+void float_to_half_array(const float *src, int n, unsigned short *dst)
+{
+    int i;
+#ifdef HALF_X86
+    if(has_f16c()){
+        float_to_half_f16c(src, n, dst);
+        return;
+    }
+#endif
+    for(i = 0; i < n; ++i) dst[i] = float_to_half(src[i]);
+}
+
+void half_to_float_array(const unsigned short *src, int n, float *dst)
+{
+    int i;
+#ifdef HALF_X86
+    if(has_f16c()){
+        half_to_float_f16c(src, n, dst);
+        return;
+    }
+#endif
+    for(i = 0; i < n; ++i) dst[i] = half_to_float(src[i]);
+}
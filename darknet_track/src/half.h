@@ -0,0 +1,9 @@
+#ifndef HALF_H
+#define HALF_H
+
+/** IEEE 754 binary16 storage for weights; all arithmetic stays in fp32 */
+
+void float_to_half_array(const float *src, int n, unsigned short *dst);
+void half_to_float_array(const unsigned short *src, int n, float *dst);
+
+#endif
@@ -5,6 +5,11 @@
 #include <stdio.h>
 #include <math.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LETTERBOX_X86
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -516,31 +521,6 @@ void ipl_into_image(IplImage* src, image im)
     }
 }
 
-void ipl_into_image_org(IplImage* src, image im)
-{
-    unsigned char *data = (unsigned char *)src->imageData;
-    int h = src->height;
-    int w = src->width;
-    int c = src->nChannels;
-    int step = src->widthStep;
-    int i, j, k;
-
-#if 0
-    for(i = 0; i < h; ++i){
-        for(k= 0; k < c; ++k){
-            for(j = 0; j < w; ++j){
-                im.data[k*w*h + i*w + j] = data[i*step + j*c + k];
-            }
-        }
-    }
-#else
-    LOGV("w=%d step=%d h=%d c=%d imageSize=%d\n", w, step, h, c, src->imageSize);
-    im.data = realloc(im.data, src->imageSize /* h * step * c */);
-    //im.data = malloc(h * step * c + 10000);
-    memcpy(im.data, data, (h * (step)));
-#endif
-}
-
 image ipl_to_image(IplImage* src)
 {
     LOGD("DEBUGME\n");
@@ -616,36 +596,53 @@ int fill_image_from_stream(CvCapture *cap, image im)
     return 1;
 }
 
-image get_image_from_stream_sj(CvCapture *cap, tFrameInfo* apCpy)
+/**
+ * copy of the decoded 8-bit frame (interleaved BGR, widthStep bytes per row) in apCpy->im, the
+ * only full resolution copy a frame needs: the tracker reads it as is and letterbox_bytes_into()
+ * makes the network input from it. apCpy->im must be empty or from an earlier call.
+ * src is area-resampled to w x h on the way in; w or h <= 0 keeps src's size
+ */
+void ipl_into_frame_info_scaled(IplImage* src, tFrameInfo* apCpy, int w, int h)
 {
-    IplImage* src = cvQueryFrame(cap);
-    if (!src) return make_empty_image(0,0,0);
-    if(apCpy)
+    int step;
+    if(w <= 0 || h <= 0)
+    {
+        w = src->width;
+        h = src->height;
+    }
+    /** rows padded to 4 bytes, as cvCreateImage() would */
+    step = (w == src->width && h == src->height) ? src->widthStep : (w * src->nChannels + 3) & ~3;
+    LOGV("w=%d h=%d c=%d -> w=%d h=%d\n", src->width, src->height, src->nChannels, w, h);
+    /** the raw copy is allocated on first use and then refilled in place */
+    if(apCpy->im.data && (apCpy->im.w != w || apCpy->im.h != h || apCpy->im.c != src->nChannels || apCpy->widthStep != step))
     {
-        LOGV("w=%d h=%d c=%d\n", src->width, src->height, src->nChannels);
-        apCpy->im = make_image(src->width, src->height, src->nChannels);
-        ipl_into_image_org(src, apCpy->im);
-        LOGD("DEBUGME\n");
-        apCpy->widthStep = src->widthStep;
+        free_image(apCpy->im);
+        apCpy->im.data = NULL;
+    }
+    if(!apCpy->im.data)
+    {
+        apCpy->im = make_empty_image(w, h, src->nChannels);
+        apCpy->im.data = calloc(1, (size_t)h * step);
+    }
+    apCpy->widthStep = step;
+    if(w == src->width && h == src->height)
+    {
+        memcpy(apCpy->im.data, src->imageData, src->height * src->widthStep);
+        return;
+    }
+    {
+        IplImage dst;
+        cvInitImageHeader(&dst, cvSize(w, h), src->depth, src->nChannels, IPL_ORIGIN_TL, 4);
+        cvSetData(&dst, apCpy->im.data, step);
+        cvResize(src, &dst, CV_INTER_AREA);
     }
-    image im = ipl_to_image(src);
-    rgbgr_image(im);
-    return im;
 }
 
-int fill_image_from_stream_sj(CvCapture *cap, image im, tFrameInfo* apCpy)
+int fill_frame_info_from_stream(CvCapture *cap, tFrameInfo* apCpy, int w, int h)
 {
     IplImage* src = cvQueryFrame(cap);
     if (!src) return 0;
-    if(apCpy)
-    {
-        LOGV("w=%d h=%d c=%d\n", src->width, src->height, src->nChannels);
-        apCpy->im = make_image(src->width, src->height, src->nChannels);
-        ipl_into_image_org(src, apCpy->im);
-        apCpy->widthStep = src->widthStep;
-    }
-    ipl_into_image(src, im);
-    rgbgr_image(im);
+    ipl_into_frame_info_scaled(src, apCpy, w, h);
     return 1;
 }
 
@@ -937,6 +934,175 @@ void letterbox_image_into(image im, int w, int h, image boxed)
     free_image(resized);
 }
 
+void free_letterbox_table(letterbox_table *table)
+{
+    free(table->x0);
+    free(table->xw);
+    free(table->y0);
+    free(table->yw);
+    free(table->rows);
+    memset(table, 0, sizeof(letterbox_table));
+}
+
+/** source index and weight of its right/lower neighbour for each of n outputs resampled from
+ * size inputs, as resize_image() places them; the last output takes the last input at weight 1 */
+static void letterbox_axis_table(int size, int n, int *i0, float *wt)
+{
+    int i;
+    float scale = (n > 1) ? (float)(size - 1) / (n - 1) : 0;
+    for(i = 0; i < n; ++i){
+        float s = i*scale;
+        int is = (int)s;
+        float d = s - is;
+        if(size == 1){
+            is = 0;
+            d = 0;
+        } else if(i == n - 1 || is >= size - 1){
+            is = size - 2;
+            d = 1;
+        }
+        i0[i] = is;
+        wt[i] = d;
+    }
+}
+
+static void setup_letterbox_table(letterbox_table *t, int w, int h, int c, image boxed)
+{
+    if(t->x0 && t->src_w == w && t->src_h == h && t->c == c && t->dst_w == boxed.w && t->dst_h == boxed.h) return;
+    free_letterbox_table(t);
+    t->src_w = w;
+    t->src_h = h;
+    t->c = c;
+    t->dst_w = boxed.w;
+    t->dst_h = boxed.h;
+    if(((float)boxed.w/w) < ((float)boxed.h/h)){
+        t->new_w = boxed.w;
+        t->new_h = (h * boxed.w)/w;
+    } else {
+        t->new_h = boxed.h;
+        t->new_w = (w * boxed.h)/h;
+    }
+    t->dx = (boxed.w - t->new_w)/2;
+    t->dy = (boxed.h - t->new_h)/2;
+    t->x0 = (int*)calloc(t->new_w, sizeof(int));
+    t->xw = (float*)calloc(t->new_w, sizeof(float));
+    t->y0 = (int*)calloc(t->new_h, sizeof(int));
+    t->yw = (float*)calloc(t->new_h, sizeof(float));
+    t->rows = (float*)calloc(2*c*t->new_w, sizeof(float));
+    letterbox_axis_table(w, t->new_w, t->x0, t->xw);
+    letterbox_axis_table(h, t->new_h, t->y0, t->yw);
+}
+
+#ifdef LETTERBOX_X86
+/** letterbox_resample_row() for 8 columns at a time of 3 channel pixels, gathering the bytes of
+ * the two neighbouring pixels; only for columns whose 4 byte gathers stay inside the row */
+__attribute__((target("avx2")))
+static int letterbox_resample_row_avx2(const unsigned char *row, const letterbox_table *t, int n, float *out)
+{
+    int x, k;
+    const __m256i lo = _mm256_set1_epi32(0xff);
+    for(x = 0; x + 8 <= n; x += 8){
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(t->x0 + x));
+        idx = _mm256_add_epi32(idx, _mm256_add_epi32(idx, idx));
+        __m256 wt = _mm256_loadu_ps(t->xw + x);
+        for(k = 0; k < 3; ++k){
+            __m256i a = _mm256_and_si256(_mm256_i32gather_epi32((const int *)(row + k), idx, 1), lo);
+            __m256i b = _mm256_and_si256(_mm256_i32gather_epi32((const int *)(row + k + 3), idx, 1), lo);
+            __m256 fa = _mm256_cvtepi32_ps(a);
+            __m256 fb = _mm256_cvtepi32_ps(b);
+            _mm256_storeu_ps(out + k*t->new_w + x, _mm256_add_ps(fa, _mm256_mul_ps(wt, _mm256_sub_ps(fb, fa))));
+        }
+    }
+    return x;
+}
+#endif
+
+/** one source row of interleaved bytes resampled to new_w columns, into c planes of floats */
+static void letterbox_resample_row(const unsigned char *row, const letterbox_table *t, float *out)
+{
+    int x = 0, k;
+    int c = t->c;
+#ifdef LETTERBOX_X86
+    static int avx2 = -1;
+    if(avx2 < 0) avx2 = __builtin_cpu_supports("avx2");
+    if(avx2 && c == 3){
+        /** the gathers read 4 bytes per channel of the right pixel: the last columns, where
+         * that would run past the row, are left to the scalar loop */
+        int n = t->new_w;
+        while(n > 0 && 3*(t->x0[n-1] + 1) + 2 + 4 > 3*t->src_w) --n;
+        x = letterbox_resample_row_avx2(row, t, n, out);
+    }
+#endif
+    for(; x < t->new_w; ++x){
+        const unsigned char *p = row + t->x0[x]*c;
+        const unsigned char *q = (t->src_w > 1) ? p + c : p;
+        float wt = t->xw[x];
+        for(k = 0; k < c; ++k){
+            out[k*t->new_w + x] = p[k] + wt*(q[k] - p[k]);
+        }
+    }
+}
+
+/**
+ * letterbox_image_into() straight from 8-bit interleaved pixels (step bytes per row, BGR when
+ * bgr is set, as OpenCV decodes): bilinear resampling from precomputed tables, the channel swap
+ * and the 1/255 scaling in one pass, and only the source rows the resize reads are touched.
+ * The border is filled with .5 as letterbox_image() does
+ */
+void letterbox_bytes_into(const unsigned char *data, int w, int h, int c, int step, int bgr, image boxed, letterbox_table *table)
+{
+    int r, x, k;
+    letterbox_table *t = table;
+    setup_letterbox_table(t, w, h, c, boxed);
+    int new_w = t->new_w;
+    float *upper = t->rows;
+    float *lower = t->rows + c*new_w;
+    int upper_row = -1, lower_row = -1;
+    const float scale = 1.f/255;
+
+    for(k = 0; k < boxed.c; ++k){
+        float *plane = boxed.data + k*boxed.w*boxed.h;
+        for(r = 0; r < boxed.h; ++r){
+            float *out = plane + r*boxed.w;
+            if(r < t->dy || r >= t->dy + t->new_h){
+                fill_cpu(boxed.w, .5, out, 1);
+                continue;
+            }
+            for(x = 0; x < t->dx; ++x) out[x] = .5;
+            for(x = t->dx + new_w; x < boxed.w; ++x) out[x] = .5;
+        }
+    }
+    for(r = 0; r < t->new_h; ++r){
+        int y0 = t->y0[r];
+        int y1 = (h > 1) ? y0 + 1 : y0;
+        float wt = t->yw[r];
+        if(y0 == lower_row){
+            float *swap = upper;
+            upper = lower;
+            lower = swap;
+            upper_row = lower_row;
+            lower_row = -1;
+        }
+        if(y0 != upper_row){
+            letterbox_resample_row(data + (size_t)y0*step, t, upper);
+            upper_row = y0;
+        }
+        if(y1 != lower_row){
+            letterbox_resample_row(data + (size_t)y1*step, t, lower);
+            lower_row = y1;
+        }
+        for(k = 0; k < c && k < boxed.c; ++k){
+            int plane = (bgr && c == 3) ? 2 - k : k;
+            float *out = boxed.data + (plane*boxed.h + t->dy + r)*boxed.w + t->dx;
+            const float *a = upper + k*new_w;
+            const float *b = lower + k*new_w;
+            for(x = 0; x < new_w; ++x){
+                out[x] = (a[x] + wt*(b[x] - a[x]))*scale;
+            }
+        }
+    }
+}
+
 image letterbox_image(image im, int w, int h)
 {
     int new_w = im.w;
@@ -17,9 +17,10 @@ extern "C" {
 #ifndef __cplusplus
 #ifdef OPENCV
 int fill_image_from_stream(CvCapture *cap, image im);
-int fill_image_from_stream_sj(CvCapture *cap, image im, tFrameInfo* apCpy);
+/** 8-bit copy of src in apCpy->im, area-resampled to w x h; w or h <= 0 keeps src's size */
+void ipl_into_frame_info_scaled(IplImage* src, tFrameInfo* apCpy, int w, int h);
+int fill_frame_info_from_stream(CvCapture *cap, tFrameInfo* apCpy, int w, int h);
 image get_image_from_stream(CvCapture *cap);
-image get_image_from_stream_sj(CvCapture *cap, tFrameInfo* apCpy);
 image ipl_to_image(IplImage* src);
 void ipl_into_image(IplImage* src, image im);
 void flush_stream_buffer(CvCapture *cap, int n);
@@ -40,6 +41,21 @@ image random_crop_image(image im, int w, int h);
 image random_augment_image(image im, float angle, float aspect, int low, int high, int w, int h);
 augment_args random_augment_args(image im, float angle, float aspect, int low, int high, int w, int h);
 void letterbox_image_into(image im, int w, int h, image boxed);
+
+/** bilinear tables and row scratch of letterbox_bytes_into(), rebuilt when the geometry changes */
+typedef struct {
+    int src_w, src_h, c;        /**< geometry the tables were built for */
+    int dst_w, dst_h;
+    int new_w, new_h, dx, dy;   /**< the resized image and its offset in the letterbox */
+    int *x0;                    /**< per output column: left source column, and */
+    float *xw;                  /**< the weight of the column right of it */
+    int *y0;                    /**< the same per output row */
+    float *yw;
+    float *rows;                /**< two horizontally resampled source rows, c planes each */
+} letterbox_table;
+
+void letterbox_bytes_into(const unsigned char *data, int w, int h, int c, int step, int bgr, image boxed, letterbox_table *table);
+void free_letterbox_table(letterbox_table *table);
 image resize_max(image im, int max);
 void translate_image(image m, float s);
 void embed_image(image source, image dest, int dx, int dy);
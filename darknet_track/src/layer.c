@@ -31,10 +31,15 @@ void free_layer(layer l)
     if(l.bias_updates)       free(l.bias_updates);
     if(l.scales)             free(l.scales);
     if(l.scale_updates)      free(l.scale_updates);
-    if(l.weights)            free(l.weights);
+    if(l.weights && !l.mapped_weights) free(l.weights);
     if(l.weight_updates)     free(l.weight_updates);
+    if(l.winograd_weights)   free(l.winograd_weights);
+    if(l.weights_half)       free(l.weights_half);
+    if(l.qweights)           free(l.qweights);
+    if(l.qweight_sums)       free(l.qweight_sums);
+    if(l.qscales)            free(l.qscales);
     if(l.delta)              free(l.delta);
-    if(l.output)             free(l.output);
+    if(l.output && !l.borrowed_output) free(l.output);
     if(l.squared)            free(l.squared);
     if(l.norms)              free(l.norms);
     if(l.spatial_mean)       free(l.spatial_mean);
@@ -1,7 +1,13 @@
 #include "maxpool_layer.h"
 #include "cuda.h"
+#include "thread_pool.h"
 #include <stdio.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MAXPOOL_X86
+#endif
+
 image get_maxpool_image(maxpool_layer l)
 {
     int h = l.out_h;
@@ -77,9 +83,153 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     #endif
 }
 
+typedef struct {
+    const maxpool_layer *l;
+    float *input;
+} maxpool_args;
+
+/** output rows [start, end) of every image in the batch, NHWC: the max runs across a pixel's
+ * channels, which are contiguous in both input and output */
+static void maxpool_nhwc_rows(void *ptr, int start, int end)
+{
+    maxpool_args *a = (maxpool_args *)ptr;
+    const maxpool_layer *l = a->l;
+    int c = l->c;
+    int r, j, n, m, k;
+    for(r = start; r < end; ++r){
+        int b = r / l->out_h;
+        int i = r % l->out_h;
+        float *in = a->input + b*l->inputs;
+        for(j = 0; j < l->out_w; ++j){
+            float *out = l->output + b*l->outputs + (i*l->out_w + j)*c;
+            for(k = 0; k < c; ++k) out[k] = -FLT_MAX;
+            for(n = 0; n < l->size; ++n){
+                int y = i*l->stride - l->pad + n;
+                if(y < 0 || y >= l->h) continue;
+                for(m = 0; m < l->size; ++m){
+                    int x = j*l->stride - l->pad + m;
+                    if(x < 0 || x >= l->w) continue;
+                    float *p = in + (y*l->w + x)*c;
+                    for(k = 0; k < c; ++k) out[k] = (p[k] > out[k]) ? p[k] : out[k];
+                }
+            }
+        }
+    }
+}
+
+/** one output row of a 2x2 / stride 2 pool: the max of two input rows, then of adjacent pairs */
+static void maxpool_2x2_row(const float *r0, const float *r1, float *out, int out_w)
+{
+    int j;
+    for(j = 0; j < out_w; ++j){
+        float a = (r0[2*j] > r0[2*j+1]) ? r0[2*j] : r0[2*j+1];
+        float b = (r1[2*j] > r1[2*j+1]) ? r1[2*j] : r1[2*j+1];
+        out[j] = (a > b) ? a : b;
+    }
+}
+
+#ifdef MAXPOOL_X86
+/** 8 outputs per step: the vertical max of 16 inputs, split into even and odd columns */
+__attribute__((target("avx2")))
+static void maxpool_2x2_row_avx2(const float *r0, const float *r1, float *out, int out_w)
+{
+    int j;
+    for(j = 0; j + 8 <= out_w; j += 8){
+        __m256 lo = _mm256_max_ps(_mm256_loadu_ps(r0 + 2*j), _mm256_loadu_ps(r1 + 2*j));
+        __m256 hi = _mm256_max_ps(_mm256_loadu_ps(r0 + 2*j + 8), _mm256_loadu_ps(r1 + 2*j + 8));
+        __m256 even = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 odd = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256 m = _mm256_max_ps(even, odd);
+        /** the shuffles work per 128-bit lane: reorder the 64-bit pairs to 0 2 1 3 */
+        m = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(m), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(out + j, m);
+    }
+    maxpool_2x2_row(r0 + 2*j, r1 + 2*j, out + j, out_w - j);
+}
+#endif
+
+/** planes [start, end) of a 2x2 / stride 2 / pad 0 pool, where every window lies inside the
+ * image; inference only, so no indexes */
+static void maxpool_2x2_planes(void *ptr, int start, int end)
+{
+    maxpool_args *a = (maxpool_args *)ptr;
+    const maxpool_layer *l = a->l;
+    int p, i;
+#ifdef MAXPOOL_X86
+    static int avx2 = -1;
+    if(avx2 < 0) avx2 = __builtin_cpu_supports("avx2");
+#endif
+    for(p = start; p < end; ++p){
+        const float *in = a->input + (size_t)p*l->h*l->w;
+        float *out = l->output + (size_t)p*l->out_h*l->out_w;
+        for(i = 0; i < l->out_h; ++i){
+            const float *r0 = in + 2*i*l->w;
+#ifdef MAXPOOL_X86
+            if(avx2){
+                maxpool_2x2_row_avx2(r0, r0 + l->w, out + i*l->out_w, l->out_w);
+                continue;
+            }
+#endif
+            maxpool_2x2_row(r0, r0 + l->w, out + i*l->out_w, l->out_w);
+        }
+    }
+}
+
+typedef struct {
+    const maxpool_layer *l;
+    const float *band;
+    int ld;
+    float *out;
+    int rows;
+} maxpool_band_args;
+
+static void maxpool_2x2_band_planes(void *ptr, int start, int end)
+{
+    maxpool_band_args *a = (maxpool_band_args *)ptr;
+    const maxpool_layer *l = a->l;
+    int k, i;
+#ifdef MAXPOOL_X86
+    static int avx2 = -1;
+    if(avx2 < 0) avx2 = __builtin_cpu_supports("avx2");
+#endif
+    for(k = start; k < end; ++k){
+        const float *in = a->band + (size_t)k*a->ld;
+        float *out = a->out + (size_t)k*l->out_h*l->out_w;
+        for(i = 0; i < a->rows; ++i){
+            const float *r0 = in + 2*i*l->w;
+#ifdef MAXPOOL_X86
+            if(avx2){
+                maxpool_2x2_row_avx2(r0, r0 + l->w, out + i*l->out_w, l->out_w);
+                continue;
+            }
+#endif
+            maxpool_2x2_row(r0, r0 + l->w, out + i*l->out_w, l->out_w);
+        }
+    }
+}
+
+/** pools a band of 2*rows input rows (channel planes ld floats apart) of image b into output rows
+ * [row0, row0 + rows) of a 2x2 / stride 2 / pad 0 layer; for producers that fuse the pool */
+void forward_maxpool_band(const maxpool_layer l, const float *band, int ld, int b, int row0, int rows)
+{
+    maxpool_band_args args = {&l, band, ld, l.output + b*l.outputs + row0*l.out_w, rows};
+    parallel_for(l.c, 1, maxpool_2x2_band_planes, &args);
+}
+
 void forward_maxpool_layer(const maxpool_layer l, network net)
 {
     int b,i,j,k,m,n;
+    if(l.nhwc){
+        /** inference only, so no indexes */
+        maxpool_args args = {&l, net.input};
+        parallel_for(l.batch*l.out_h, 1, maxpool_nhwc_rows, &args);
+        return;
+    }
+    if(!net.train && l.size == 2 && l.stride == 2 && l.pad == 0){
+        maxpool_args args = {&l, net.input};
+        parallel_for(l.batch*l.c, 1, maxpool_2x2_planes, &args);
+        return;
+    }
     int w_offset = -l.pad;
     int h_offset = -l.pad;
 
@@ -107,7 +257,7 @@ void forward_maxpool_layer(const maxpool_layer l, network net)
                         }
                     }
                     l.output[out_index] = max;
-                    l.indexes[out_index] = max_i;
+                    if(net.train) l.indexes[out_index] = max_i;
                 }
             }
         }
@@ -12,6 +12,7 @@ image get_maxpool_image(maxpool_layer l);
 maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding);
 void resize_maxpool_layer(maxpool_layer *l, int w, int h);
 void forward_maxpool_layer(const maxpool_layer l, network net);
+void forward_maxpool_band(const maxpool_layer l, const float *band, int ld, int b, int row0, int rows);
 void backward_maxpool_layer(const maxpool_layer l, network net);
 
 #ifdef GPU
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <assert.h>
+#include <sys/mman.h>
 #include "network.h"
 #include "image.h"
 #include "data.h"
@@ -50,9 +51,14 @@ load_args get_base_args(network net)
 
 network load_network(char *cfg, char *weights, int clear)
 {
-    network net = parse_network_cfg(cfg);
-    if(weights && weights[0] != 0){
-        load_weights(&net, weights);
+    network net;
+    if(weights && weights[0] != 0 && is_weights_map(weights)){
+        net = parse_network_cfg_mapped(cfg, weights);
+    } else {
+        net = parse_network_cfg(cfg);
+        if(weights && weights[0] != 0){
+            load_weights(&net, weights);
+        }
     }
     if(clear) *net.seen = 0;
     return net;
@@ -182,12 +188,25 @@ network make_network(int n)
 void forward_network(network net)
 {
     int i;
+    int nhwc = 0;
     for(i = 0; i < net.n; ++i){
         net.index = i;
         layer l = net.layers[i];
-        if(l.delta){
+        if(l.delta && net.train){
             fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
+        if(l.fused){
+            nhwc = l.nhwc;
+            net.input = l.output;
+            continue;
+        }
+        if(l.nhwc != nhwc && l.type != ROUTE){
+            int c = i ? net.layers[i-1].out_c : net.c;
+            int spatial = i ? net.layers[i-1].out_h*net.layers[i-1].out_w : net.h*net.w;
+            transpose_layout_cpu(net.input, spatial, c, l.batch, l.nhwc, net.layout_buffer);
+            net.input = net.layout_buffer;
+        }
+        nhwc = l.nhwc;
         l.forward(l, net);
         net.input = l.output;
         if(l.truth) {
@@ -321,6 +340,22 @@ void set_batch_network(network *net, int b)
     }
 }
 
+/** scratch for the transposes forward_network() does where the layout changes */
+static void alloc_layout_buffer(network *net)
+{
+    int i;
+    size_t size = 0;
+    int nhwc = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        size_t s = (size_t)(i ? net->layers[i-1].outputs : net->inputs)*l.batch;
+        if(l.nhwc != nhwc && l.type != ROUTE && s > size) size = s;
+        nhwc = l.nhwc;
+    }
+    free(net->layout_buffer);
+    net->layout_buffer = size ? (float*)calloc(size, sizeof(float)) : 0;
+}
+
 int resize_network(network *net, int w, int h)
 {
 #ifdef GPU
@@ -328,6 +363,9 @@ int resize_network(network *net, int w, int h)
     cuda_free(net->workspace);
 #endif
     int i;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].fused || net->layers[i].borrowed_output) error("Cannot resize a network fused for inference");
+    }
     //if(w == net->w && h == net->h) return 0;
     net->w = w;
     net->h = h;
@@ -390,10 +428,373 @@ int resize_network(network *net, int w, int h)
     free(net->workspace);
     net->workspace = (float*)calloc(1, workspace_size);
 #endif
+    if(net->layout_buffer) alloc_layout_buffer(net);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
 
+/** CPU convolutions run as implicit GEMM and only need the workspace for Winograd scratch going
+ * forward, so a network which is only run forward keeps just what its forward passes need.
+ * Training needs the full workspace back: resize_network() restores it */
+void shrink_workspace_for_inference(network *net)
+{
+    int i;
+    size_t workspace_size = 0;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        size_t s = (l.type == CONVOLUTIONAL) ? get_convolutional_inference_workspace_size(l) : l.workspace_size;
+        if(s > workspace_size) workspace_size = s;
+    }
+    free(net->workspace);
+    net->workspace = workspace_size ? (float*)calloc(1, workspace_size) : 0;
+}
+
+/**
+ * Picks the layers that run NHWC: folded fp32 convolutions, maxpool, plain reorg, routes of NHWC
+ * layers and same-size shortcuts. forward_network() transposes wherever the layout changes,
+ * which for YOLO is only the network input and the region layer. The last layer, and layers a
+ * resampling shortcut reads, stay planar
+ */
+static void setup_nhwc_layout(network *net)
+{
+    int i, j;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    if(net->n <= 0) return;
+    size_t count = net->n;
+    int *keep_chw = (int*)calloc(count, sizeof(int));
+    keep_chw[net->n-1] = 1;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == SHORTCUT && (l.w != l.out_w || l.h != l.out_h || l.c != l.out_c)){
+            keep_chw[l.index] = 1;
+            keep_chw[i] = 1;
+        }
+    }
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        if(keep_chw[i]) continue;
+        if(l->type == CONVOLUTIONAL){
+            convert_convolutional_layer_nhwc(l);
+        } else if(l->type == MAXPOOL){
+            l->nhwc = 1;
+        } else if(l->type == REORG){
+            l->nhwc = !l->flatten && !l->extra && !l->reverse;
+        } else if(l->type == ROUTE){
+            l->nhwc = 1;
+            for(j = 0; j < l->n; ++j){
+                if(!net->layers[l->input_layers[j]].nhwc) l->nhwc = 0;
+            }
+        } else if(l->type == SHORTCUT){
+            l->nhwc = net->layers[l->index].nhwc;
+        }
+    }
+    free(keep_chw);
+    alloc_layout_buffer(net);
+}
+
+/** number of route and shortcut inputs reading each layer's output */
+static int *count_output_readers(network *net)
+{
+    int i, j;
+    if(net->n <= 0) return 0;
+    size_t count = net->n;
+    int *readers = (int*)calloc(count, sizeof(int));
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j) ++readers[l.input_layers[j]];
+        } else if(l.type == SHORTCUT){
+            ++readers[l.index];
+        }
+    }
+    return readers;
+}
+
+/**
+ * Removes the copies and round trips through memory between layers of the parsed graph:
+ *  - a convolution followed by a 2x2 / stride 2 maxpool pools bands of its own output, see
+ *    fuse_convolutional_maxpool(), and the pool layer is skipped;
+ *  - a route of one layer aliases that layer's output;
+ *  - the inputs of a planar batch 1 route (convolutions, maxpools, reorgs nothing else reads)
+ *    write straight into their slice of the route output, which then copies nothing.
+ * Fused layers are skipped by forward_network() and the network can't be resized afterwards.
+ */
+static void fuse_network_layers(network *net, int folded)
+{
+    int i, j;
+    int pools = 0, aliases = 0, slices = 0;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    int *readers = count_output_readers(net);
+    for(i = 0; i + 1 < net->n; ++i){
+        layer *l = &net->layers[i];
+        if(l->type != CONVOLUTIONAL || net->layers[i+1].type != MAXPOOL || readers[i]) continue;
+        if(fuse_convolutional_maxpool(l, &net->layers[i+1])){
+            free(l->output);
+            l->output = 0;
+            ++pools;
+        }
+    }
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        if(l->type != ROUTE) continue;
+        if(l->n == 1){
+            layer *src = &net->layers[l->input_layers[0]];
+            if(src->nhwc != l->nhwc || !src->output) continue;
+            free(l->output);
+            l->output = src->output;
+            l->borrowed_output = 1;
+            l->fused = 1;
+            ++aliases;
+            continue;
+        }
+        if(l->batch != 1 || l->nhwc) continue;
+        int offset = 0;
+        for(j = 0; j < l->n; ++j){
+            int index = l->input_layers[j];
+            layer *src = &net->layers[index];
+            int type = src->type;
+            if((type == CONVOLUTIONAL || type == MAXPOOL || type == REORG) && readers[index] == 1
+                    && index != net->n - 1 && !src->nhwc && !src->borrowed_output && src->output){
+                free(src->output);
+                src->output = l->output + offset;
+                src->borrowed_output = 1;
+                ++slices;
+            }
+            offset += l->input_sizes[j];
+        }
+    }
+    free(readers);
+    fprintf(stderr, "Fused for inference: %d batch norms folded, %d conv+maxpool, %d routes aliased, %d route inputs written in place\n",
+            folded, pools, aliases, slices);
+}
+
+/** layer types whose forward pass reads nothing but its input, routed and shortcut layers and its
+ * own output */
+static int is_plannable_layer(LAYER_TYPE type)
+{
+    return type == CONVOLUTIONAL || type == MAXPOOL || type == AVGPOOL || type == ROUTE || type == REORG || type == SHORTCUT;
+}
+
+#define FREE_TRAINING_BUFFER(p) do { free(p); (p) = 0; } while(0)
+
+/** frees what only training uses: deltas, batch norm statistics of the batch, gradients, adam
+ * moments and maxpool indexes. Layers that fill their delta going forward (region, cost, ...)
+ * keep everything */
+static void free_training_buffers(network *net)
+{
+    int i;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        if(!is_plannable_layer(l->type) || l->batch_normalize) continue;
+        FREE_TRAINING_BUFFER(l->delta);
+        FREE_TRAINING_BUFFER(l->x);
+        FREE_TRAINING_BUFFER(l->x_norm);
+        FREE_TRAINING_BUFFER(l->mean);
+        FREE_TRAINING_BUFFER(l->variance);
+        FREE_TRAINING_BUFFER(l->mean_delta);
+        FREE_TRAINING_BUFFER(l->variance_delta);
+        FREE_TRAINING_BUFFER(l->weight_updates);
+        FREE_TRAINING_BUFFER(l->bias_updates);
+        FREE_TRAINING_BUFFER(l->scale_updates);
+        FREE_TRAINING_BUFFER(l->m);
+        FREE_TRAINING_BUFFER(l->v);
+        FREE_TRAINING_BUFFER(l->bias_m);
+        FREE_TRAINING_BUFFER(l->bias_v);
+        FREE_TRAINING_BUFFER(l->scale_m);
+        FREE_TRAINING_BUFFER(l->scale_v);
+        if(l->type == MAXPOOL) FREE_TRAINING_BUFFER(l->indexes);
+    }
+}
+
+typedef struct {
+    int buffer;                 /**< layer owning the buffer */
+    int start, end;             /**< first layer writing it, last layer reading it */
+    size_t size;
+} output_lifetime;
+
+static int output_lifetime_comparator(const void *a, const void *b)
+{
+    const output_lifetime *x = (const output_lifetime *)a;
+    const output_lifetime *y = (const output_lifetime *)b;
+    if(x->start != y->start) return x->start - y->start;
+    return (x->size < y->size) - (x->size > y->size);
+}
+
+/**
+ * Inference memory planner. Every output buffer is live from the first layer writing it to the
+ * last one reading it (the next layer, routes and shortcuts); buffers that are never live at the
+ * same time share a slot of one arena, so activation memory is about the largest live set instead
+ * of the sum of all outputs. Route inputs written in place and aliased routes move with the route
+ * buffer they point into. The last layer keeps its own buffer: it is net->output.
+ */
+static void plan_network_outputs(network *net)
+{
+    int i, j, k;
+    int n = net->n;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    if(n <= 0) return;
+    size_t nlayers = n;
+    for(i = 0; i < n - 1; ++i){
+        if(!is_plannable_layer(net->layers[i].type)) return;
+    }
+
+    /** owner[i]: the layer whose buffer layer i writes its output to, -1 for none */
+    int *owner = (int*)calloc(nlayers, sizeof(int));
+    for(i = 0; i < n; ++i) owner[i] = net->layers[i].output ? i : -1;
+    for(i = 0; i < n; ++i){
+        layer l = net->layers[i];
+        if(l.type != ROUTE || l.fused) continue;
+        float *slice = l.output;
+        for(j = 0; j < l.n; ++j){
+            layer *src = &net->layers[l.input_layers[j]];
+            if(src->borrowed_output && src->output == slice) owner[l.input_layers[j]] = i;
+            slice += l.input_sizes[j];
+        }
+    }
+    for(i = 0; i < n; ++i){
+        layer l = net->layers[i];
+        if(l.type == ROUTE && l.fused) owner[i] = owner[l.input_layers[0]];
+        if(l.borrowed_output && owner[i] == i) goto done;
+    }
+
+    int *start = (int*)calloc(nlayers, sizeof(int));
+    int *end = (int*)calloc(nlayers, sizeof(int));
+    for(i = 0; i < n; ++i){
+        start[i] = n;
+        end[i] = -1;
+    }
+    for(i = 0; i < n; ++i){
+        layer l = net->layers[i];
+        int b = owner[i];
+        if(b < 0) continue;
+        int write = (l.type == MAXPOOL && l.fused) ? i - 1 : i;
+        if(write < start[b]) start[b] = write;
+        int next = (i + 1 < n) ? i + 1 : i;
+        if(next > end[b]) end[b] = next;
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j){
+                int src = owner[l.input_layers[j]];
+                if(src >= 0 && i > end[src]) end[src] = i;
+            }
+        } else if(l.type == SHORTCUT){
+            int src = owner[l.index];
+            if(src >= 0 && i > end[src]) end[src] = i;
+        }
+    }
+
+    int count = 0;
+    output_lifetime *buffers = (output_lifetime*)calloc(nlayers, sizeof(output_lifetime));
+    for(i = 0; i < n - 1; ++i){
+        if(owner[i] != i || owner[n-1] == i) continue;
+        output_lifetime b = {i, start[i], end[i], (size_t)net->layers[i].outputs*net->layers[i].batch};
+        buffers[count++] = b;
+    }
+    qsort(buffers, count, sizeof(output_lifetime), output_lifetime_comparator);
+
+    /** greedy: the smallest free slot that fits, else the largest free slot grown to fit */
+    int slots = 0;
+    int *slot = (int*)calloc(nlayers, sizeof(int));
+    int *slot_end = (int*)calloc(nlayers, sizeof(int));
+    size_t *slot_size = (size_t*)calloc(nlayers, sizeof(size_t));
+    size_t *slot_offset = (size_t*)calloc(nlayers, sizeof(size_t));
+    size_t unplanned = 0, total = 0;
+    for(i = 0; i < count; ++i){
+        output_lifetime b = buffers[i];
+        int best = -1;
+        for(k = 0; k < slots; ++k){
+            if(slot_end[k] >= b.start) continue;
+            if(best < 0){
+                best = k;
+            } else if(slot_size[k] >= b.size){
+                if(slot_size[best] < b.size || slot_size[k] < slot_size[best]) best = k;
+            } else if(slot_size[best] < b.size && slot_size[k] > slot_size[best]){
+                best = k;
+            }
+        }
+        if(best < 0) best = slots++;
+        if(b.size > slot_size[best]) slot_size[best] = b.size;
+        slot_end[best] = b.end;
+        slot[b.buffer] = best;
+        unplanned += b.size;
+    }
+    for(k = 0; k < slots; ++k){
+        slot_offset[k] = total;
+        total += slot_size[k];
+    }
+
+    float *arena = (float*)calloc(total ? total : 1, sizeof(float));
+    float **moved = (float**)calloc(nlayers, sizeof(float*));
+    for(i = 0; i < count; ++i){
+        int b = buffers[i].buffer;
+        for(j = 0; j < n; ++j){
+            if(owner[j] == b) moved[j] = arena + slot_offset[slot[b]] + (net->layers[j].output - net->layers[b].output);
+        }
+    }
+    for(i = 0; i < count; ++i){
+        free(net->layers[buffers[i].buffer].output);
+    }
+    for(j = 0; j < n; ++j){
+        if(!moved[j]) continue;
+        net->layers[j].output = moved[j];
+        net->layers[j].borrowed_output = 1;
+    }
+    free(net->output_arena);
+    net->output_arena = arena;
+    fprintf(stderr, "Planned %d layer outputs into %d arena slots: %.1f MB instead of %.1f MB\n",
+            count, slots, total*sizeof(float)/1e6, unplanned*sizeof(float)/1e6);
+
+    free(moved);
+    free(slot_offset);
+    free(slot_size);
+    free(slot_end);
+    free(slot);
+    free(buffers);
+    free(end);
+    free(start);
+done:
+    free(owner);
+}
+
+/** one-time preparation of a loaded network that will only be run forward: batch norm is folded
+ * into the convolution weights, calibrated layers of an int8 network are quantized, a half
+ * network swaps its convolution weights for fp16 copies, layout=nhwc switches the backbone to
+ * channels-last, neighbouring layers are fused, training buffers are dropped, layer outputs
+ * share planned arenas and the workspace is trimmed. Call after load_weights() and
+ * set_batch_network(); the network can no longer be trained, saved or resized afterwards */
+void finalize_network_for_inference(network *net)
+{
+    int i;
+    int folded = 0;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type == CONVOLUTIONAL){
+            folded += net->layers[i].batch_normalize;
+            fold_convolutional_batchnorm(&net->layers[i]);
+#ifdef GPU
+            if(gpu_index >= 0) continue;
+#endif
+            if(net->int8) quantize_convolutional_layer(&net->layers[i]);
+            if(net->half) convert_convolutional_weights_half(&net->layers[i]);
+        }
+    }
+    if(net->nhwc) setup_nhwc_layout(net);
+    fuse_network_layers(net, folded);
+    free_training_buffers(net);
+    plan_network_outputs(net);
+    shrink_workspace_for_inference(net);
+}
+
 detection_layer get_network_detection_layer(network net)
 {
     int i;
@@ -616,6 +1017,9 @@ void free_network(network net)
     free(net.layers);
     if(net.input) free(net.input);
     if(net.truth) free(net.truth);
+    if(net.layout_buffer) free(net.layout_buffer);
+    if(net.weights_map) munmap(net.weights_map, net.weights_map_size);
+    if(net.output_arena) free(net.output_arena);
 #ifdef GPU
     if(net.input_gpu) cuda_free(net.input_gpu);
     if(net.truth_gpu) cuda_free(net.truth_gpu);
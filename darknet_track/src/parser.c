@@ -2,6 +2,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "activation_layer.h"
 #include "activations.h"
@@ -23,12 +27,14 @@
 #include "normalization_layer.h"
 #include "option_list.h"
 #include "parser.h"
+#include "half.h"
 #include "region_layer.h"
 #include "reorg_layer.h"
 #include "rnn_layer.h"
 #include "route_layer.h"
 #include "shortcut_layer.h"
 #include "softmax_layer.h"
+#include "thread_pool.h"
 #include "lstm_layer.h"
 #include "utils.h"
 
@@ -120,6 +126,7 @@ typedef struct size_params{
     int c;
     int index;
     int time_steps;
+    int init_weights;
     network net;
 } size_params;
 
@@ -192,7 +199,7 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     int binary = option_find_int_quiet(options, "binary", 0);
     int xnor = option_find_int_quiet(options, "xnor", 0);
 
-    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,size,stride,padding,activation, batch_normalize, binary, xnor, params.net.adam);
+    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,size,stride,padding,activation, batch_normalize, binary, xnor, params.net.adam, params.init_weights);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
 
@@ -581,6 +588,18 @@ void parse_net_options(list *options, network *net)
     net->exposure = option_find_float_quiet(options, "exposure", 1);
     net->hue = option_find_float_quiet(options, "hue", 0);
 
+    /** CPU worker threads for the forward pass; 0 uses every online core, no key leaves the pool as is */
+    int threads = option_find_int_quiet(options, "threads", -1);
+    if(threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > 0) set_cpu_threads(threads);
+    /** int8 convolutions at inference, with input ranges from the <weights>.qtable calibration */
+    net->int8 = option_find_int_quiet(options, "int8", 0);
+    /** convolution weights kept as fp16 at inference (CPU) */
+    net->half = option_find_int_quiet(options, "half", 0);
+    /** layout=nhwc: channels-last activations through the CPU backbone at inference */
+    char *layout = option_find_str(options, "layout", 0);
+    net->nhwc = layout && 0 == strcmp(layout, "nhwc");
+
     if(!net->inputs && !(net->h && net->w && net->c)) error("No input parameters supplied");
 
     char *policy_s = option_find_str(options, "policy", "constant");
@@ -630,7 +649,7 @@ int is_network(section *s)
             || strcmp(s->type, "[network]")==0);
 }
 
-network parse_network_cfg(char *filename)
+static network parse_network(char *filename, int init_weights)
 {
     list *sections = read_cfg(filename);
     node *n = sections->front;
@@ -650,6 +669,7 @@ network parse_network_cfg(char *filename)
     params.inputs = net.inputs;
     params.batch = net.batch;
     params.time_steps = net.time_steps;
+    params.init_weights = init_weights;
     params.net = net;
 
     size_t workspace_size = 0;
@@ -767,6 +787,21 @@ network parse_network_cfg(char *filename)
     return net;
 }
 
+network parse_network_cfg(char *filename)
+{
+    return parse_network(filename, 1);
+}
+
+/** the network for cfg with its weights bound to the weights map in weights, see
+ * save_weights_mapped(). The convolutions never allocate or initialize weights of their own, so
+ * this takes milliseconds where parse_network_cfg() + load_weights() takes seconds */
+network parse_network_cfg_mapped(char *filename, char *weights)
+{
+    network net = parse_network(filename, 0);
+    load_weights(&net, weights);
+    return net;
+}
+
 list *read_cfg(char *filename)
 {
     FILE *file = fopen(filename, "r");
@@ -834,7 +869,64 @@ void save_convolutional_weights_binary(layer l, FILE *fp)
     }
 }
 
-void save_convolutional_weights(layer l, FILE *fp)
+/** revision bit of a .weights header: convolution weight arrays are stored as fp16, everything
+ * else (biases, batch norm, other layers) stays fp32 */
+#define WEIGHTS_REVISION_HALF 0x10000
+
+/**
+ * Weights map: the inference form of a .weights file, written by save_weights_mapped(). A header,
+ * one weights_map_entry per layer, then every array at a WEIGHTS_MAP_ALIGN aligned offset, so
+ * the layers can use their weights straight from a read-only shared mmap() of the file: loading
+ * reads nothing up front and every process running the model shares one copy of it in the page
+ * cache. Convolutions are stored with batch norm folded in, because the mapping can't be
+ * written; biases and batch norm statistics are small and are copied out.
+ */
+#define WEIGHTS_MAP_MAGIC 0x4d4e5744    /* "DWNM" */
+#define WEIGHTS_MAP_VERSION 1
+#define WEIGHTS_MAP_ALIGN 64
+
+enum {WEIGHTS_MAP_BIASES, WEIGHTS_MAP_SCALES, WEIGHTS_MAP_MEAN, WEIGHTS_MAP_VARIANCE, WEIGHTS_MAP_WEIGHTS, WEIGHTS_MAP_ARRAYS};
+
+typedef struct {
+    int magic;
+    int version;
+    int n;                      /**< layers, one entry each */
+    int pad;
+    size_t seen;
+} weights_map_header;
+
+typedef struct {
+    int type;
+    int nbiases;                /**< floats in each of biases, scales, mean and variance */
+    size_t nweights;
+    size_t offset[WEIGHTS_MAP_ARRAYS];  /**< byte offsets into the file, 0 for arrays not stored */
+} weights_map_entry;
+
+static void write_weight_array(float *w, int n, int half, FILE *fp)
+{
+    if(!half){
+        fwrite(w, sizeof(float), n, fp);
+        return;
+    }
+    unsigned short *h = (unsigned short*)calloc(n, sizeof(unsigned short));
+    float_to_half_array(w, n, h);
+    fwrite(h, sizeof(unsigned short), n, fp);
+    free(h);
+}
+
+static void read_weight_array(float *w, int n, int half, FILE *fp)
+{
+    if(!half){
+        fread(w, sizeof(float), n, fp);
+        return;
+    }
+    unsigned short *h = (unsigned short*)calloc(n, sizeof(unsigned short));
+    fread(h, sizeof(unsigned short), n, fp);
+    half_to_float_array(h, n, w);
+    free(h);
+}
+
+void save_convolutional_weights(layer l, FILE *fp, int half)
 {
     if(l.binary){
         //save_convolutional_weights_binary(l, fp);
@@ -852,7 +944,7 @@ void save_convolutional_weights(layer l, FILE *fp)
         fwrite(l.rolling_mean, sizeof(float), l.n, fp);
         fwrite(l.rolling_variance, sizeof(float), l.n, fp);
     }
-    fwrite(l.weights, sizeof(float), num, fp);
+    write_weight_array(l.weights, num, half, fp);
 }
 
 void save_batchnorm_weights(layer l, FILE *fp)
@@ -883,7 +975,7 @@ void save_connected_weights(layer l, FILE *fp)
     }
 }
 
-void save_weights_upto(network net, char *filename, int cutoff)
+static void save_weights_as(network net, char *filename, int cutoff, int half)
 {
 #ifdef GPU
     if(net.gpu_index >= 0){
@@ -896,7 +988,7 @@ void save_weights_upto(network net, char *filename, int cutoff)
 
     int major = 0;
     int minor = 2;
-    int revision = 0;
+    int revision = half ? WEIGHTS_REVISION_HALF : 0;
     fwrite(&major, sizeof(int), 1, fp);
     fwrite(&minor, sizeof(int), 1, fp);
     fwrite(&revision, sizeof(int), 1, fp);
@@ -906,7 +998,7 @@ void save_weights_upto(network net, char *filename, int cutoff)
     for(i = 0; i < net.n && i < cutoff; ++i){
         layer l = net.layers[i];
         if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
-            save_convolutional_weights(l, fp);
+            save_convolutional_weights(l, fp, half);
         } if(l.type == CONNECTED){
             save_connected_weights(l, fp);
         } if(l.type == BATCHNORM){
@@ -938,9 +1030,9 @@ void save_weights_upto(network net, char *filename, int cutoff)
                 save_connected_weights(*(l.state_layer), fp);
             }
         }  if(l.type == CRNN){
-            save_convolutional_weights(*(l.input_layer), fp);
-            save_convolutional_weights(*(l.self_layer), fp);
-            save_convolutional_weights(*(l.output_layer), fp);
+            save_convolutional_weights(*(l.input_layer), fp, half);
+            save_convolutional_weights(*(l.self_layer), fp, half);
+            save_convolutional_weights(*(l.output_layer), fp, half);
         } if(l.type == LOCAL){
 #ifdef GPU
             if(gpu_index >= 0){
@@ -955,11 +1047,104 @@ void save_weights_upto(network net, char *filename, int cutoff)
     }
     fclose(fp);
 }
+void save_weights_upto(network net, char *filename, int cutoff)
+{
+    save_weights_as(net, filename, cutoff, 0);
+}
+
+/** the same file with the convolution weights in fp16, about half the size; load_weights()
+ * reads either */
+void save_weights_half(network net, char *filename)
+{
+    save_weights_as(net, filename, net.n, 1);
+}
+
 void save_weights(network net, char *filename)
 {
     save_weights_upto(net, filename, net.n);
 }
 
+/** which arrays of l a weights map stores, marked by a non-zero offset, and their sizes */
+static void weights_map_arrays(layer l, weights_map_entry *e)
+{
+    memset(e, 0, sizeof(weights_map_entry));
+    e->type = l.type;
+    if(l.type == CONVOLUTIONAL){
+        e->nbiases = l.n;
+        e->nweights = (size_t)l.n*l.c*l.size*l.size;
+        e->offset[WEIGHTS_MAP_BIASES] = e->offset[WEIGHTS_MAP_WEIGHTS] = 1;
+    } else if(l.type == CONNECTED){
+        e->nbiases = l.outputs;
+        e->nweights = (size_t)l.outputs*l.inputs;
+        e->offset[WEIGHTS_MAP_BIASES] = e->offset[WEIGHTS_MAP_WEIGHTS] = 1;
+        if(l.batch_normalize){
+            e->offset[WEIGHTS_MAP_SCALES] = e->offset[WEIGHTS_MAP_MEAN] = e->offset[WEIGHTS_MAP_VARIANCE] = 1;
+        }
+    } else if(l.type == BATCHNORM){
+        e->nbiases = l.c;
+        e->offset[WEIGHTS_MAP_SCALES] = e->offset[WEIGHTS_MAP_MEAN] = e->offset[WEIGHTS_MAP_VARIANCE] = 1;
+    } else if(l.type == LOCAL){
+        e->nbiases = l.outputs;
+        e->nweights = (size_t)l.size*l.size*l.c*l.n*l.out_w*l.out_h;
+        e->offset[WEIGHTS_MAP_BIASES] = e->offset[WEIGHTS_MAP_WEIGHTS] = 1;
+    } else if(l.type == DECONVOLUTIONAL || l.type == CRNN || l.type == RNN || l.type == LSTM || l.type == GRU){
+        error("Weights maps don't support deconvolutional or recurrent layers");
+    }
+}
+
+/** writes net as a weights map for inference, see WEIGHTS_MAP_MAGIC; load_weights() maps it */
+void save_weights_mapped(network net, char *filename)
+{
+    int i, j;
+    weights_map_header h = {WEIGHTS_MAP_MAGIC, WEIGHTS_MAP_VERSION, net.n, 0, *net.seen};
+    weights_map_entry *entries = (weights_map_entry*)calloc(net.n, sizeof(weights_map_entry));
+    size_t offset = sizeof(h) + net.n*sizeof(weights_map_entry);
+    for(i = 0; i < net.n; ++i){
+        weights_map_arrays(net.layers[i], &entries[i]);
+        for(j = 0; j < WEIGHTS_MAP_ARRAYS; ++j){
+            if(!entries[i].offset[j]) continue;
+            offset = (offset + WEIGHTS_MAP_ALIGN - 1) & ~(size_t)(WEIGHTS_MAP_ALIGN - 1);
+            entries[i].offset[j] = offset;
+            offset += (j == WEIGHTS_MAP_WEIGHTS ? entries[i].nweights : (size_t)entries[i].nbiases)*sizeof(float);
+        }
+    }
+
+    fprintf(stderr, "Saving weights map to %s\n", filename);
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(entries, sizeof(weights_map_entry), net.n, fp);
+    for(i = 0; i < net.n; ++i){
+        layer l = net.layers[i];
+        float *biases = 0, *weights = 0;
+        if(l.type == CONVOLUTIONAL){
+#ifdef GPU
+            if(gpu_index >= 0){
+                pull_convolutional_layer(l);
+            }
+#endif
+            if(!l.weights) error("Weights maps are written from fp32 weights");
+            if(l.batch_normalize){
+                biases = (float*)calloc(l.n, sizeof(float));
+                weights = (float*)calloc(entries[i].nweights, sizeof(float));
+                fold_convolutional_batchnorm_into(l, biases, weights);
+                l.biases = biases;
+                l.weights = weights;
+            }
+        }
+        float *arrays[WEIGHTS_MAP_ARRAYS] = {l.biases, l.scales, l.rolling_mean, l.rolling_variance, l.weights};
+        for(j = 0; j < WEIGHTS_MAP_ARRAYS; ++j){
+            if(!entries[i].offset[j]) continue;
+            fseek(fp, entries[i].offset[j], SEEK_SET);
+            fwrite(arrays[j], sizeof(float), j == WEIGHTS_MAP_WEIGHTS ? entries[i].nweights : (size_t)entries[i].nbiases, fp);
+        }
+        free(biases);
+        free(weights);
+    }
+    fclose(fp);
+    free(entries);
+}
+
 void transpose_matrix(float *a, int rows, int cols)
 {
     float *transpose = (float*)calloc(rows*cols, sizeof(float));
@@ -1039,7 +1224,7 @@ void load_convolutional_weights_binary(layer l, FILE *fp)
 #endif
 }
 
-void load_convolutional_weights(layer l, FILE *fp)
+void load_convolutional_weights(layer l, FILE *fp, int half)
 {
     if(l.binary){
         //load_convolutional_weights_binary(l, fp);
@@ -1067,12 +1252,13 @@ void load_convolutional_weights(layer l, FILE *fp)
             fill_cpu(l.n, 0, l.rolling_variance, 1);
         }
     }
-    fread(l.weights, sizeof(float), num, fp);
+    read_weight_array(l.weights, num, half, fp);
     //if(l.c == 3) scal_cpu(num, 1./256, l.weights, 1);
     if (l.flipped) {
         transpose_matrix(l.weights, l.c*l.size*l.size, l.n);
     }
     //if (l.binary) binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.weights);
+    update_winograd_weights(l);
 #ifdef GPU
     if(gpu_index >= 0){
         push_convolutional_layer(l);
@@ -1106,7 +1292,9 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
         fread(&iseen, sizeof(int), 1, fp);
         *net->seen = iseen;
     }
+    if(major == WEIGHTS_MAP_MAGIC) error("Weights maps load with load_weights(), not by layer range");
     int transpose = (major > 1000) || (minor > 1000);
+    int half = (revision & WEIGHTS_REVISION_HALF) != 0;
 
     int i;
     for(i = start; i < net->n && i < cutoff; ++i){
@@ -1127,7 +1315,7 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
             );
         if (l.dontload) continue;
         if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
-            load_convolutional_weights(l, fp);
+            load_convolutional_weights(l, fp, half);
         }
         if(l.type == CONNECTED){
             load_connected_weights(l, fp, transpose);
@@ -1136,9 +1324,9 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
             load_batchnorm_weights(l, fp);
         }
         if(l.type == CRNN){
-            load_convolutional_weights(*(l.input_layer), fp);
-            load_convolutional_weights(*(l.self_layer), fp);
-            load_convolutional_weights(*(l.output_layer), fp);
+            load_convolutional_weights(*(l.input_layer), fp, half);
+            load_convolutional_weights(*(l.self_layer), fp, half);
+            load_convolutional_weights(*(l.output_layer), fp, half);
         }
         if(l.type == RNN){
             load_connected_weights(*(l.input_layer), fp, transpose);
@@ -1185,8 +1373,132 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
     fclose(fp);
 }
 
+int is_weights_map(char *filename)
+{
+    int magic = 0;
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    fread(&magic, sizeof(int), 1, fp);
+    fclose(fp);
+    return magic == WEIGHTS_MAP_MAGIC;
+}
+
+/**
+ * Points the layers' weights into a read-only shared mapping of a weights map; the mapping lives
+ * as long as the network. Convolutions are marked folded, so the network runs forward only:
+ * training would write to the mapping.
+ */
+static void map_weights(network *net, char *filename)
+{
+    int i, j;
+    struct stat st;
+    fprintf(stderr, "Mapping weights from %s...", filename);
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st)) file_error(filename);
+    size_t size = st.st_size;
+    char *map = (char*)mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) error("Couldn't map weights");
+
+    weights_map_header *h = (weights_map_header*)map;
+    weights_map_entry *entries = (weights_map_entry*)(h + 1);
+    if(size < sizeof(weights_map_header) || h->version != WEIGHTS_MAP_VERSION) error("Unsupported weights map version");
+    if(h->n != net->n || size < sizeof(weights_map_header) + h->n*sizeof(weights_map_entry)){
+        error("Weights map doesn't match the network");
+    }
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        weights_map_entry e = entries[i];
+        weights_map_entry want;
+        weights_map_arrays(*l, &want);
+        if(e.type != want.type || e.nbiases != want.nbiases || e.nweights != want.nweights){
+            error("Weights map doesn't match the network");
+        }
+        for(j = 0; j < WEIGHTS_MAP_ARRAYS; ++j){
+            size_t bytes = (j == WEIGHTS_MAP_WEIGHTS ? e.nweights : (size_t)e.nbiases)*sizeof(float);
+            if(!e.offset[j] != !want.offset[j]) error("Weights map doesn't match the network");
+            if(e.offset[j] && (e.offset[j] % WEIGHTS_MAP_ALIGN || e.offset[j] > size || bytes > size - e.offset[j])){
+                error("Corrupt weights map");
+            }
+        }
+
+        float *arrays[WEIGHTS_MAP_WEIGHTS] = {l->biases, l->scales, l->rolling_mean, l->rolling_variance};
+        for(j = 0; j < WEIGHTS_MAP_WEIGHTS; ++j){
+            if(e.offset[j]) memcpy(arrays[j], map + e.offset[j], e.nbiases*sizeof(float));
+        }
+        if(e.offset[WEIGHTS_MAP_WEIGHTS]){
+            if(!l->mapped_weights) free(l->weights);
+            l->weights = (float*)(map + e.offset[WEIGHTS_MAP_WEIGHTS]);
+            l->mapped_weights = 1;
+        }
+        if(l->type == CONVOLUTIONAL){
+            l->batch_normalize = 0;
+            update_winograd_weights(*l);
+        }
+#ifdef GPU
+        if(gpu_index >= 0){
+            if(l->type == CONVOLUTIONAL) push_convolutional_layer(*l);
+            if(l->type == CONNECTED) push_connected_layer(*l);
+            if(l->type == BATCHNORM) push_batchnorm_layer(*l);
+            if(l->type == LOCAL) push_local_layer(*l);
+        }
+#endif
+    }
+    *net->seen = h->seen;
+    if(net->weights_map) munmap(net->weights_map, net->weights_map_size);
+    net->weights_map = map;
+    net->weights_map_size = size;
+    fprintf(stderr, "Done!\n");
+}
+
 void load_weights(network *net, char *filename)
 {
-    load_weights_upto(net, filename, 0, net->n);
+    if(is_weights_map(filename)){
+        map_weights(net, filename);
+    } else {
+        load_weights_upto(net, filename, 0, net->n);
+    }
+    if(net->int8){
+        char buff[256];
+        sprintf(buff, "%s.qtable", filename);
+        load_quantization_table(net, buff);
+    }
+}
+
+/** the calibration table is text, one "layer max|input|" line per int8 convolution */
+void save_quantization_table(network net, float *ranges, char *filename)
+{
+    int i;
+    fprintf(stderr, "Saving quantization table to %s\n", filename);
+    FILE *fp = fopen(filename, "w");
+    if(!fp) file_error(filename);
+    fprintf(fp, "# layer max|input|\n");
+    for(i = 0; i < net.n; ++i){
+        if(ranges[i] > 0) fprintf(fp, "%d %g\n", i, ranges[i]);
+    }
+    fclose(fp);
+}
+
+void load_quantization_table(network *net, char *filename)
+{
+    char *line;
+    int count = 0;
+    FILE *fp = fopen(filename, "r");
+    if(!fp){
+        fprintf(stderr, "Couldn't open quantization table %s, running in fp32\n", filename);
+        return;
+    }
+    while((line = fgetl(fp)) != 0){
+        int i;
+        float range;
+        if(line[0] != '#' && sscanf(line, "%d %f", &i, &range) == 2 && i >= 0 && i < net->n
+                && net->layers[i].type == CONVOLUTIONAL){
+            net->layers[i].qinput_range = range;
+            ++count;
+        }
+        free(line);
+    }
+    fclose(fp);
+    fprintf(stderr, "Loaded int8 ranges for %d layers from %s\n", count, filename);
 }
 
@@ -89,10 +89,41 @@ void resize_reorg_layer(layer *l, int w, int h)
 #endif
 }
 
+/** reorg_cpu(.., forward = 0) with NHWC input and output: the element order reorg_cpu() produces
+ * in the planar layout is kept, each side's planar index is just mapped to its NHWC position */
+static void reorg_nhwc_cpu(const layer l, float *x, float *out)
+{
+    int b, i, j, k;
+    int out_c = l.c/(l.stride*l.stride);
+    for(b = 0; b < l.batch; ++b){
+        float *in = x + b*l.inputs;
+        float *o = out + b*l.outputs;
+        for(k = 0; k < l.c; ++k){
+            for(j = 0; j < l.h; ++j){
+                for(i = 0; i < l.w; ++i){
+                    int dst = i + l.w*(j + l.h*k);
+                    int c2 = k % out_c;
+                    int offset = k / out_c;
+                    int w2 = i*l.stride + offset % l.stride;
+                    int h2 = j*l.stride + offset / l.stride;
+                    int src = w2 + l.w*l.stride*(h2 + l.h*l.stride*c2);
+                    int dst_c = dst / (l.out_w*l.out_h);
+                    int dst_p = dst % (l.out_w*l.out_h);
+                    int src_c = src / (l.w*l.h);
+                    int src_p = src % (l.w*l.h);
+                    o[dst_p*l.out_c + dst_c] = in[src_p*l.c + src_c];
+                }
+            }
+        }
+    }
+}
+
 void forward_reorg_layer(const layer l, network net)
 {
     int i;
-    if(l.flatten){
+    if(l.nhwc){
+        reorg_nhwc_cpu(l, net.input, l.output);
+    } else if(l.flatten){
         memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
         if(l.reverse){
             flatten(l.output, l.w*l.h, l.c, l.batch, 0);
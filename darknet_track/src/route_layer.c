@@ -72,16 +72,38 @@ void resize_route_layer(route_layer *l, network *net)
     
 }
 
+/** one input into its channel slice [c0, c0 + c) of the output when either side is NHWC */
+static void route_copy_layout(float *in, int in_nhwc, int c, float *out, int out_nhwc, int out_c, int c0, int spatial)
+{
+    int p, k;
+    for(p = 0; p < spatial; ++p){
+        for(k = 0; k < c; ++k){
+            float v = in_nhwc ? in[p*c + k] : in[k*spatial + p];
+            if(out_nhwc) out[p*out_c + c0 + k] = v;
+            else out[(c0 + k)*spatial + p] = v;
+        }
+    }
+}
+
 void forward_route_layer(const route_layer l, network net)
 {
     int i, j;
     int offset = 0;
+    int spatial = l.out_w*l.out_h;
     for(i = 0; i < l.n; ++i){
         int index = l.input_layers[i];
         float *input = net.layers[index].output;
         int input_size = l.input_sizes[i];
+        int in_nhwc = net.layers[index].nhwc;
         for(j = 0; j < l.batch; ++j){
-            copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
+            /** a producer fused for inference writes its slice in place */
+            if(input + j*input_size == l.output + offset + j*l.outputs) continue;
+            if(l.nhwc || in_nhwc){
+                route_copy_layout(input + j*input_size, in_nhwc, input_size/spatial,
+                        l.output + j*l.outputs, l.nhwc, l.out_c, offset/spatial, spatial);
+            } else {
+                copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
+            }
         }
         offset += input_size;
     }
@@ -0,0 +1,138 @@
+#include "thread_pool.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/** process wide pool of CPU workers for the forward pass; the workers live until
+ * the pool is resized and the calling thread always takes a share of the work */
+#define MAX_CPU_THREADS 256
+
+typedef struct {
+    pthread_t threads[MAX_CPU_THREADS];
+    int nthreads;               /**< including the caller */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_mutex_t busy;       /**< held by the thread running a parallel_for() */
+    unsigned long generation;   /**< bumped for every job; also used to retire workers */
+    unsigned long spawned;      /**< generation the current workers were started at */
+    int quit;
+    parallel_fn fn;
+    void *args;
+    int n;
+    int grain;
+    int next;                   /**< first unclaimed item */
+    int active;                 /**< workers still on the current job */
+} thread_pool;
+
+static thread_pool pool = {
+    .nthreads = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/** set on pool workers so a parallel_for() from inside a job runs serially */
+static __thread int in_pool_worker = 0;
+
+static void run_chunks(parallel_fn fn, void *args, int n, int grain)
+{
+    int start;
+    while((start = __sync_fetch_and_add(&pool.next, grain)) < n){
+        int end = (start + grain < n) ? start + grain : n;
+        fn(args, start, end);
+    }
+}
+
+static void *pool_worker(void *ptr)
+{
+    unsigned long seen;
+    in_pool_worker = 1;
+    pthread_mutex_lock(&pool.lock);
+    seen = pool.spawned;
+    while(1){
+        while(pool.generation == seen && !pool.quit) pthread_cond_wait(&pool.wake, &pool.lock);
+        if(pool.quit) break;
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_chunks(pool.fn, pool.args, pool.n, pool.grain);
+
+        pthread_mutex_lock(&pool.lock);
+        if(--pool.active == 0) pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return 0;
+}
+
+static void stop_workers()
+{
+    int i;
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = 1;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for(i = 1; i < pool.nthreads; ++i) pthread_join(pool.threads[i], 0);
+    pool.quit = 0;
+    pool.nthreads = 1;
+}
+
+/** resize the pool to n threads (the caller counts as one); n <= 1 runs everything on the caller */
+void set_cpu_threads(int n)
+{
+    int i;
+    if(n < 1) n = 1;
+    if(n > MAX_CPU_THREADS) n = MAX_CPU_THREADS;
+    pthread_mutex_lock(&pool.busy);
+    if(n != pool.nthreads){
+        stop_workers();
+        pthread_mutex_lock(&pool.lock);
+        pool.spawned = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+        for(i = 1; i < n; ++i){
+            if(pthread_create(&pool.threads[i], 0, pool_worker, 0)) error("Thread creation failed");
+        }
+        pool.nthreads = n;
+        fprintf(stderr, "CPU threads: %d\n", n);
+    }
+    pthread_mutex_unlock(&pool.busy);
+}
+
+int get_cpu_threads()
+{
+    return pool.nthreads;
+}
+
+/**
+ * fn(args, start, end) over [0, n) in chunks of grain items, spread over the pool;
+ * returns when all of them ran. Runs serially on the caller when the pool has one thread,
+ * when called from inside a job or while another thread has the pool
+ */
+void parallel_for(int n, int grain, parallel_fn fn, void *args)
+{
+    if(n <= 0) return;
+    if(grain < 1) grain = 1;
+    if(pool.nthreads < 2 || n <= grain || in_pool_worker || pthread_mutex_trylock(&pool.busy)){
+        fn(args, 0, n);
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.args = args;
+    pool.n = n;
+    pool.grain = grain;
+    pool.next = 0;
+    pool.active = pool.nthreads - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_chunks(fn, args, n, grain);
+
+    pthread_mutex_lock(&pool.lock);
+    while(pool.active) pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.busy);
+}
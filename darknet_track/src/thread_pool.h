@@ -0,0 +1,11 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/** body of a parallel_for(); runs items [start, end) */
+typedef void (*parallel_fn)(void *args, int start, int end);
+
+void set_cpu_threads(int n);
+int get_cpu_threads();
+void parallel_for(int n, int grain, parallel_fn fn, void *args);
+
+#endif
@@ -0,0 +1,194 @@
+#include "winograd.h"
+#include "gemm.h"
+#include "thread_pool.h"
+#include "activations.h"
+#include <string.h>
+
+/** F(2x2,3x3): every 2x2 output tile comes from a 4x4 input tile.
+ * Y = A^T [ (G g G^T) .* (B^T d B) ] A, done for all tiles at once as 16
+ * independent (filters x channels) * (channels x tiles) GEMMs, one per
+ * element of the 4x4 transformed tile.  16 multiplies per tile instead of
+ * 36 is the 2.25x arithmetic saving. */
+
+/** the scratch holds 16*(c + n) floats per tile; tiles are processed in
+ * blocks so it stays around this many floats regardless of image size */
+#define WINOGRAD_BLOCK_FLOATS (1<<21)
+#define WINOGRAD_MIN_BLOCK 64
+/** the 16 planes are offset by this much so power-of-two plane sizes don't alias in cache */
+#define WINOGRAD_PLANE_PAD 16
+
+static int winograd_block(int n, int c, int h, int w)
+{
+    int tiles = ((h + 1)/2)*((w + 1)/2);
+    int tb = WINOGRAD_BLOCK_FLOATS/(16*(c + n));
+    if(tb < WINOGRAD_MIN_BLOCK) tb = WINOGRAD_MIN_BLOCK;
+    if(tb > tiles) tb = tiles;
+    return tb;
+}
+
+size_t winograd_workspace_size(int n, int c, int h, int w)
+{
+    return (size_t)16*((size_t)(c + n)*winograd_block(n, c, h, w) + 2*WINOGRAD_PLANE_PAD);
+}
+
+void winograd_transform_weights(float *weights, int n, int c, float *transformed)
+{
+    int f, ch, i;
+    for(f = 0; f < n; ++f){
+        for(ch = 0; ch < c; ++ch){
+            float *g = weights + (f*c + ch)*9;
+            float t[4][3];
+            float u[16];
+            /** G g */
+            for(i = 0; i < 3; ++i){
+                t[0][i] = g[i];
+                t[1][i] = .5f*(g[i] + g[3 + i] + g[6 + i]);
+                t[2][i] = .5f*(g[i] - g[3 + i] + g[6 + i]);
+                t[3][i] = g[6 + i];
+            }
+            /** (G g) G^T */
+            for(i = 0; i < 4; ++i){
+                u[i*4 + 0] = t[i][0];
+                u[i*4 + 1] = .5f*(t[i][0] + t[i][1] + t[i][2]);
+                u[i*4 + 2] = .5f*(t[i][0] - t[i][1] + t[i][2]);
+                u[i*4 + 3] = t[i][2];
+            }
+            for(i = 0; i < 16; ++i){
+                transformed[(i*n + f)*c + ch] = u[i];
+            }
+        }
+    }
+}
+
+typedef struct {
+    float *im;
+    int c, h, w;
+    int tiles_w;
+    int t0, nt, tb;
+    size_t vstep, mstep;    /**< distance between two of the 16 planes of V and M */
+    float *V;
+    float *M;
+    float *out;
+    int n;
+    float *bias;
+    ACTIVATION activation;
+} winograd_args;
+
+/** B^T d B for channels [start, end) of the current tile block */
+static void winograd_input_range(void *ptr, int start, int end)
+{
+    winograd_args *a = (winograd_args *)ptr;
+    int h = a->h, w = a->w;
+    int ch, j, i, x, y;
+    for(ch = start; ch < end; ++ch){
+        float *im = a->im + ch*h*w;
+        for(j = 0; j < a->nt; ++j){
+            int t = a->t0 + j;
+            int y0 = (t / a->tiles_w)*2 - 1;
+            int x0 = (t % a->tiles_w)*2 - 1;
+            float d[4][4];
+            float s[4][4];
+            if(y0 >= 0 && x0 >= 0 && y0 + 4 <= h && x0 + 4 <= w){
+                for(y = 0; y < 4; ++y){
+                    for(x = 0; x < 4; ++x) d[y][x] = im[(y0 + y)*w + x0 + x];
+                }
+            } else {
+                for(y = 0; y < 4; ++y){
+                    for(x = 0; x < 4; ++x){
+                        int iy = y0 + y, ix = x0 + x;
+                        d[y][x] = (iy < 0 || ix < 0 || iy >= h || ix >= w) ? 0 : im[iy*w + ix];
+                    }
+                }
+            }
+            /** B^T d */
+            for(x = 0; x < 4; ++x){
+                s[0][x] = d[0][x] - d[2][x];
+                s[1][x] = d[1][x] + d[2][x];
+                s[2][x] = d[2][x] - d[1][x];
+                s[3][x] = d[1][x] - d[3][x];
+            }
+            /** (B^T d) B */
+            for(i = 0; i < 4; ++i){
+                size_t step = a->vstep;
+                float *v = a->V + i*4*step + ch*a->tb + j;
+                v[0]      = s[i][0] - s[i][2];
+                v[step]   = s[i][1] + s[i][2];
+                v[2*step] = s[i][2] - s[i][1];
+                v[3*step] = s[i][1] - s[i][3];
+            }
+        }
+    }
+}
+
+/** A^T m A for filters [start, end) of the current tile block */
+static void winograd_output_range(void *ptr, int start, int end)
+{
+    winograd_args *a = (winograd_args *)ptr;
+    int h = a->h, w = a->w;
+    size_t step = a->mstep;
+    int f, j, i;
+    for(f = start; f < end; ++f){
+        float *out = a->out + f*h*w;
+        for(j = 0; j < a->nt; ++j){
+            int t = a->t0 + j;
+            int y0 = (t / a->tiles_w)*2;
+            int x0 = (t % a->tiles_w)*2;
+            float *m = a->M + f*a->tb + j;
+            float s[2][4];
+            /** A^T m */
+            for(i = 0; i < 4; ++i){
+                float m0 = m[i*step], m1 = m[(4 + i)*step], m2 = m[(8 + i)*step], m3 = m[(12 + i)*step];
+                s[0][i] = m0 + m1 + m2;
+                s[1][i] = m1 - m2 - m3;
+            }
+            /** (A^T m) A, plus the fused bias / activation */
+            for(i = 0; i < 2; ++i){
+                float y_0 = s[i][0] + s[i][1] + s[i][2];
+                float y_1 = s[i][1] - s[i][2] - s[i][3];
+                if(y0 + i >= h) break;
+                if(a->bias){
+                    y_0 = activate(y_0 + a->bias[f], a->activation);
+                    y_1 = activate(y_1 + a->bias[f], a->activation);
+                }
+                out[(y0 + i)*w + x0] = y_0;
+                if(x0 + 1 < w) out[(y0 + i)*w + x0 + 1] = y_1;
+            }
+        }
+    }
+}
+
+void winograd_conv3x3_cpu(float *transformed, int n, float *im, int c, int h, int w,
+        float *bias, ACTIVATION activation, float *out, float *workspace)
+{
+    int tiles_w = (w + 1)/2;
+    int tiles = ((h + 1)/2)*tiles_w;
+    int tb = winograd_block(n, c, h, w);
+    int threads = get_cpu_threads();
+    int i;
+
+    winograd_args a;
+    a.im = im;
+    a.c = c; a.h = h; a.w = w;
+    a.n = n;
+    a.tiles_w = tiles_w;
+    a.tb = tb;
+    a.vstep = (size_t)c*tb + WINOGRAD_PLANE_PAD;
+    a.mstep = (size_t)n*tb + WINOGRAD_PLANE_PAD;
+    a.V = workspace;
+    a.M = workspace + 16*a.vstep;
+    a.out = out;
+    a.bias = bias;
+    a.activation = activation;
+
+    for(a.t0 = 0; a.t0 < tiles; a.t0 += tb){
+        a.nt = (tiles - a.t0 < tb) ? tiles - a.t0 : tb;
+        parallel_for(c, (c + 4*threads - 1)/(4*threads), winograd_input_range, &a);
+        for(i = 0; i < 16; ++i){
+            gemm(0,0,n,a.nt,c,1,
+                    transformed + (size_t)i*n*c, c,
+                    a.V + i*a.vstep, tb, 0,
+                    a.M + i*a.mstep, tb);
+        }
+        parallel_for(n, (n + 4*threads - 1)/(4*threads), winograd_output_range, &a);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include <stddef.h>
+#include "darknet.h"
+
+/** Winograd F(2x2,3x3) for 3x3 / stride 1 / pad 1 convolutions (CPU, inference) */
+
+/** 4x4 transform of each 3x3 filter; transformed is laid out as 16 n x c matrices */
+void winograd_transform_weights(float *weights, int n, int c, float *transformed);
+
+/** floats of scratch winograd_conv3x3_cpu() needs for an n-filter, c-channel layer */
+size_t winograd_workspace_size(int n, int c, int h, int w);
+
+/** out (n x h x w) = conv3x3(im (c x h x w)) using weights from winograd_transform_weights();
+ * with a bias, out = activation(conv + bias) */
+void winograd_conv3x3_cpu(float *transformed, int n, float *im, int c, int h, int w,
+        float *bias, ACTIVATION activation, float *out, float *workspace);
+
+#endif
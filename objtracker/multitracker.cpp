@@ -24,6 +24,13 @@
 #include <iostream>
 #include <cstring>
 #include <ctime>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <stdint.h>
+#include <unistd.h>
 #include "opencv2/video/tracking.hpp"
 
 #include "multitracker.h"
@@ -54,16 +61,23 @@
 //#define OPTICAL_FLOW_APPROXIMATION
 #define OPT_FLOW_WINSIZE_W 50
 #define OPT_FLOW_WINSIZE_H 50
+#define OPT_FLOW_MAX_LEVEL 3
 
 #define ABS_DIFF(a, b) ((a) > (b)) ? ((a)-(b)) : ((b)-(a))
 #define GOOD_IOU_THRESHOLD (0.5)
 #define MAX_BB_SIDE_LEN_TOLERANCE_OPT_FLOW 5
 
 #define CLASS_AGNOSTIC_BB_TRACKING
+/** a pooled tracker is re-seeded from the detection when its own estimate
+ * on the base frame drifted below this IoU */
+#define TRACKER_REINIT_IOU_THRESHOLD (0.3)
 #define ASSIGN_BBID_ONLY_ONCE
 
 //#define MULTI_ALGORITHMIC_APPROACH
 
+/** cost of a tracker/detection pair which failed the gate; anything above 1.0 */
+#define ASSOC_NO_MATCH_COST (2.0)
+
 extern "C"
 {
 
@@ -86,21 +100,24 @@ typedef struct
     tAnnInfo* pBBTOrig;
 }tTrackerBBInfo;
 
+struct TrackTable;
 void assess_iou_trackerBBs_detectedBBs(tTrackerBBInfo* pTrackerBBs,
                 const int nTrackerInSlots,
                 tAnnInfo** ppDetectedBBs,
-                tLanesInfo* pLanesInfo);
+                tLanesInfo* pLanesInfo,
+                struct TrackTable* pTable);
 tAnnInfo* make_copy_of_current_set(tAnnInfo* pDetectedBBs);
 int check_if_new_BB_acceptable(tAnnInfo* pBBIn, tAnnInfo* apCopyDetectedBBs);
 int isWithinBB(tAnnInfo* pBBP, tAnnInfo* pBBD);
 void collect_analysis(tAnnInfo* pCurrFrameBBs, tAnnInfo* pPrevFrameBBs, tLanesInfo* pLanesInfo);
-tLane* laneWithThisBB(tLanesInfo* pLanesInfo, tAnnInfo* pBBNode);
 
 }
 
-static tAnnInfo* pCopyDetectedBBs;
+static int gbDisplayInTracker = 1; /**< else the caller shows the results; see set_tracker_display_inline() */
+static double gfTrackerFps; /**< last track_bb_in_frame() speed; only drawn on the display */
 
 tAnnInfo* get_apt_candidateBB(tTrackerBBInfo* pTrackerBBs, const int nTrackerInSlots, const int i);
+double find_iou(tAnnInfo* pBB1, tAnnInfo* pBB2);
 
 inline cv::Ptr<cv::Tracker> createTrackerByName(cv::String name)
 {
@@ -129,6 +146,258 @@ using namespace cv;
 
 void display_results(Mat& imgTargM, tAnnInfo* pFinal);
 
+/** long-lived tracker state for one object; keyed by tAnnInfo::nBBId
+ * so the tracker model survives across track_bb_in_frame() calls */
+typedef struct
+{
+    Ptr<Tracker> tracker;
+    Rect2d lastBB; /**< tracker estimate on the frame it was last updated with */
+    double fLastTS; /**< timestamp of the frame lastBB belongs to */
+    unsigned long long nGeneration; /**< last track_bb_in_frame() call which used this entry */
+}tTrackEntry;
+
+/** LK pyramid of one frame; the target frame of a track_bb_in_frame() call
+ * is the base frame of the next, so 2 slots let every frame be built only once */
+typedef struct
+{
+    unsigned char* pData; /**< tFrameInfo::im.data and timestamp identify the frame */
+    double fTS;
+    unsigned long long nLastUse;
+    Mat gray;
+    std::vector<Mat> pyramid;
+}tFlowPyramid;
+
+#define MAX_FLOW_PYRAMIDS 2
+
+/** the tracker state of one video; with several streams in a process BB IDs are only unique
+ * within a stream, and a call must only see and retire its own stream's state */
+typedef struct TrackTable
+{
+    std::map<int, tTrackEntry> tracks;
+    unsigned long long nGeneration; /**< track_bb_in_frame() calls made for this stream */
+    tAnnInfo* pCopyDetectedBBs; /**< the stream's BBs after the previous call; for collect_analysis() */
+    tBBSet detected; /**< association scratch; refilled without allocating */
+    tFlowPyramid flowPyramids[MAX_FLOW_PYRAMIDS];
+    unsigned long long nFlowPyramidUse;
+    tBBAssocAlgo eAssocAlgo; /**< see set_bb_association_algo(); greedy until set */
+}tTrackTable;
+
+static std::map<int, tTrackTable> gTrackTables; /**< keyed by tAnnInfo::nVideoId */
+
+/** one slot of the USE_CV_TRACKING work; a worker writes only into its own job and entry */
+typedef struct
+{
+    tAnnInfo* pBB;
+    tTrackEntry* pTrack; /**< NULL when this slot is not tracked */
+    bool bNeedsInit;
+    bool bTracked;
+    Rect2d object;
+}tTrackJob;
+
+/**
+ * picks the pooled tracker for pBB; the tracker needs a (re-)init on the base frame
+ * when the object is new, the pooled one was last updated on a different frame
+ * or drifted away from the detection
+ * NOTE: main thread only; the workers never touch gTrackTables
+ */
+static void prepare_track_job(tTrackTable* pTable, tTrackJob* pJob, tAnnInfo* pBB, tFrameInfo* pFBase)
+{
+    tTrackEntry* pTrack = &pTable->tracks[pBB->nBBId];
+
+    pJob->pBB = pBB;
+    pJob->pTrack = NULL;
+    pJob->bNeedsInit = true;
+    pJob->bTracked = false;
+    if(pTrack->nGeneration == pTable->nGeneration)
+    {
+        LOGV("BBID=%d is already being tracked in this call\n", pBB->nBBId);
+        return;
+    }
+    pTrack->nGeneration = pTable->nGeneration;
+    pJob->pTrack = pTrack;
+    if(pTrack->tracker && pTrack->fLastTS == pFBase->fCurrentFrameTimeStamp)
+    {
+        tAnnInfo lastBB = *pBB;
+        lastBB.x = (int)pTrack->lastBB.x;
+        lastBB.y = (int)pTrack->lastBB.y;
+        lastBB.w = (int)pTrack->lastBB.width;
+        lastBB.h = (int)pTrack->lastBB.height;
+        if(find_iou(&lastBB, pBB) >= TRACKER_REINIT_IOU_THRESHOLD)
+        {
+            LOGV("reusing tracker for BBID=%d\n", pBB->nBBId);
+            pJob->bNeedsInit = false;
+        }
+    }
+}
+
+static void run_track_job(tTrackJob* pJob, Mat& imgBaseM, Mat& imgTargM)
+{
+    tTrackEntry* pTrack = pJob->pTrack;
+    tAnnInfo* pBB = pJob->pBB;
+
+    if(!pTrack)
+        return;
+
+    if(pJob->bNeedsInit)
+    {
+        /** cv::Tracker::init() can not be called twice on the same instance */
+        pTrack->tracker = createTrackerByName(TRACKING_ALGO);
+        pTrack->lastBB = Rect2d(pBB->x, pBB->y, pBB->w, pBB->h);
+        if(!pTrack->tracker || !pTrack->tracker->init(imgBaseM, pTrack->lastBB))
+        {
+            LOGV("tracker init failed for BBID=%d\n", pBB->nBBId);
+            return;
+        }
+        LOGV("initialized with %d %d %d %d\n", pBB->x, pBB->y, pBB->w, pBB->h);
+    }
+
+    //update with target
+    for(int i = 0; i < MAX_TRACK_ITERATIONS; i++)
+    {
+        pJob->bTracked = pTrack->tracker->update(imgTargM, pJob->object);
+        if(pJob->bTracked)
+        {
+            LOGV("update: (%f, %f) (%f, %f)\n", pJob->object.x, pJob->object.y, pJob->object.width, pJob->object.height);
+        }
+    }
+}
+
+/** fixed-size pool of workers, created on first use and kept for the life of the process;
+ * the calling thread works on the jobs as well */
+#define MAX_TRACKER_WORKERS 8
+
+typedef struct
+{
+    pthread_t threads[MAX_TRACKER_WORKERS];
+    int nThreads;
+    sem_t semStart;
+    sem_t semDone;
+    tTrackJob* pJobs;
+    int nJobs;
+    int nNextJob; /**< claimed atomically by the workers */
+    Mat* pImgBaseM;
+    Mat* pImgTargM;
+}tTrackerPool;
+
+static tTrackerPool gTrackerPool;
+
+static void drain_track_jobs(tTrackerPool* pPool)
+{
+    int i;
+    while((i = __sync_fetch_and_add(&pPool->nNextJob, 1)) < pPool->nJobs)
+        run_track_job(&pPool->pJobs[i], *pPool->pImgBaseM, *pPool->pImgTargM);
+}
+
+static void* tracker_worker(void* ptr)
+{
+    tTrackerPool* pPool = (tTrackerPool*)ptr;
+    while(1)
+    {
+        sem_wait(&pPool->semStart);
+        drain_track_jobs(pPool);
+        sem_post(&pPool->semDone);
+    }
+    return NULL;
+}
+
+static void init_tracker_pool()
+{
+    tTrackerPool* pPool = &gTrackerPool;
+    long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    int nWorkers = (int)MIN(MAX(nCPUs - 1, 0), MAX_TRACKER_WORKERS);
+
+    sem_init(&pPool->semStart, 0, 0);
+    sem_init(&pPool->semDone, 0, 0);
+    for(int i = 0; i < nWorkers; i++)
+    {
+        if(pthread_create(&pPool->threads[pPool->nThreads], 0, tracker_worker, pPool))
+        {
+            LOGE("tracker worker creation failed\n");
+            break;
+        }
+        pPool->nThreads++;
+    }
+    LOGV("tracker pool with %d workers\n", pPool->nThreads);
+}
+
+/** returns once every job is done; results are read back by the caller in slot order */
+static void run_track_jobs(tTrackJob* pJobs, int nJobs, Mat& imgBaseM, Mat& imgTargM)
+{
+    static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+    tTrackerPool* pPool = &gTrackerPool;
+
+    if(nJobs < 2)
+    {
+        for(int i = 0; i < nJobs; i++)
+            run_track_job(&pJobs[i], imgBaseM, imgTargM);
+        return;
+    }
+
+    pthread_once(&poolOnce, init_tracker_pool);
+    pPool->pJobs = pJobs;
+    pPool->nJobs = nJobs;
+    pPool->nNextJob = 0;
+    pPool->pImgBaseM = &imgBaseM;
+    pPool->pImgTargM = &imgTargM;
+    __sync_synchronize();
+    for(int i = 0; i < pPool->nThreads; i++)
+        sem_post(&pPool->semStart);
+    drain_track_jobs(pPool);
+    for(int i = 0; i < pPool->nThreads; i++)
+        sem_wait(&pPool->semDone);
+}
+
+/** pF's pyramid from pTable's cache; the cache is per stream so streams do not evict each other */
+static std::vector<Mat>& get_flow_pyramid(tTrackTable* pTable, tFrameInfo* pF, Mat& imgM, Size winSize)
+{
+    tFlowPyramid* pPyramids = pTable->flowPyramids;
+    tFlowPyramid* pP = &pPyramids[0];
+
+    pTable->nFlowPyramidUse++;
+    for(int i = 0; i < MAX_FLOW_PYRAMIDS; i++)
+    {
+        if(!pPyramids[i].pyramid.empty()
+           && pPyramids[i].pData == (unsigned char*)pF->im.data
+           && pPyramids[i].fTS == pF->fCurrentFrameTimeStamp)
+        {
+            LOGV("pyramid cache hit %d\n", i);
+            pPyramids[i].nLastUse = pTable->nFlowPyramidUse;
+            return pPyramids[i].pyramid;
+        }
+        if(pPyramids[i].nLastUse < pP->nLastUse)
+            pP = &pPyramids[i];
+    }
+
+    /** evict the least recently used slot */
+    if(pF->im.c == 3)
+        cvtColor(imgM, pP->gray, COLOR_BGR2GRAY);
+    else
+        pP->gray = imgM.clone();
+    pP->pyramid.clear();
+    buildOpticalFlowPyramid(pP->gray, pP->pyramid, winSize, OPT_FLOW_MAX_LEVEL, true);
+    pP->pData = (unsigned char*)pF->im.data;
+    pP->fTS = pF->fCurrentFrameTimeStamp;
+    pP->nLastUse = pTable->nFlowPyramidUse;
+
+    return pP->pyramid;
+}
+
+/** objects which were not in the input set of this call have left the scene */
+static void retire_stale_tracks(tTrackTable* pTable)
+{
+    std::map<int, tTrackEntry>::iterator it = pTable->tracks.begin();
+    while(it != pTable->tracks.end())
+    {
+        if(it->second.nGeneration != pTable->nGeneration)
+        {
+            LOGV("retiring tracker for BBID=%d\n", it->first);
+            pTable->tracks.erase(it++);
+        }
+        else
+            ++it;
+    }
+}
+
 #ifdef TEST_CODE
 int main( int argc, char** argv ){
   // show help
@@ -294,6 +563,9 @@ int track_bb_in_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase, tFrameInf
     LOGV("DEBUGME w=%d h=%d pFBase->im.c=%d\n", pFBase->im.w, pFBase->im.h, pFBase->im.c);
     imgBaseM = image_to_mat(pFBase, false);
     imgTargM = image_to_mat(pFTarg, false);
+    if(pLanesInfo && (pLanesInfo->nFrameW != pFTarg->im.w || pLanesInfo->nFrameH != pFTarg->im.h))
+        set_lanes_resolution(pLanesInfo, pFTarg->im.w, pFTarg->im.h);
+    tTrackTable* pTable = &gTrackTables[apBoundingBoxesIn->nVideoId];
 
 #if 0
     imshow("base", imgBaseM);
@@ -310,8 +582,6 @@ int track_bb_in_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase, tFrameInf
 
     // for showing the speed
     double fps;
-    String text;
-    char buffer [500];
 
     // set the default tracking algorithm
     String trackingAlg = TRACKING_ALGO;
@@ -388,118 +658,104 @@ int track_bb_in_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase, tFrameInf
         /** optical flow */
         
 #ifdef OPTICAL_FLOW
-        pBB = apBoundingBoxesIn;
-        idxIn = 0;
         tAnnInfo* pOpticalFlowOutBBs = NULL;
-        while(pBB)
         {
-            tAnnInfo* pBBTmp;
+            /** one batched LK call for the centers of all the BBs, on pyramids cached per frame */
             vector<uchar> status;
             vector<float> err;
             vector<Point2f> points[2];
-            points[0].push_back(Point2f((float)(pBB->x) + ((float)pBB->w)/2, (float)(pBB->y) + (float)(pBB->h)/2));
-            Size subPixWinSize((float)pBB->w/2,(float)pBB->h/2);
-            Mat gray;
-            cvtColor(imgBaseM, gray, COLOR_BGR2GRAY);
-            //cornerSubPix(gray, points[0], subPixWinSize, Size(-1,-1), termcrit);
-            //Size winSize(1920,1080);
             Size winSize(OPT_FLOW_WINSIZE_W, OPT_FLOW_WINSIZE_H);
-#if 0
-            std::vector<Mat> pyramid;
-            buildOpticalFlowPyramid(imgBaseM, pyramid, winSize, 2, true);
-#endif
-            calcOpticalFlowPyrLK(imgBaseM, imgTargM, points[0], points[1], status, err, winSize,
-                                 3, termcrit, 0, 0.001);
-            size_t i, k;
-            LOGV("number of output points=%ld\n", points[1].size());
-            for( i = k = 0; i < points[1].size(); i++ )
+            points[0].reserve(nInBBs);
+            pBB = apBoundingBoxesIn;
+            while(pBB)
             {
-                //if( norm(point - points[1][i]) <= 5 )
-
-                if( !status[i] )
-                    continue;
-
-                points[1][k++] = points[1][i];
-                circle( imgTargM, points[1][i], 3, Scalar(0,255,0), -1, 8);
+                points[0].push_back(Point2f((float)(pBB->x) + ((float)pBB->w)/2, (float)(pBB->y) + (float)(pBB->h)/2));
+                pBB = pBB->pNext;
             }
-            if( status[0] )
+            std::vector<Mat>& basePyramid = get_flow_pyramid(pTable, pFBase, imgBaseM, winSize);
+            std::vector<Mat>& targPyramid = get_flow_pyramid(pTable, pFTarg, imgTargM, winSize);
+            calcOpticalFlowPyrLK(basePyramid, targPyramid, points[0], points[1], status, err, winSize,
+                                 OPT_FLOW_MAX_LEVEL, termcrit, 0, 0.001);
+            LOGV("number of output points=%ld\n", points[1].size());
+
+            pBB = apBoundingBoxesIn;
+            idxIn = 0;
+            while(pBB)
             {
-            points[1].resize(k);
-            pBBTmp = &pTrackerBBs[idxIn].opticalFlowBB;
-            memcpy(pBBTmp, pBB, sizeof(tAnnInfo));
+                tAnnInfo* pBBTmp;
+                if(status[idxIn])
+                {
+                    circle(imgTargM, points[1][idxIn], 3, Scalar(0,255,0), -1, 8);
+                    pBBTmp = &pTrackerBBs[idxIn].opticalFlowBB;
+                    memcpy(pBBTmp, pBB, sizeof(tAnnInfo));
 #if 1
-            pBBTmp->x = (int)(points[1][0].x);
-            pBBTmp->y = (int)(points[1][0].y);
+                    pBBTmp->x = (int)(points[1][idxIn].x);
+                    pBBTmp->y = (int)(points[1][idxIn].y);
 #else
-            pBBTmp->x = (int)(points[1][0].x - ((pBB->w * 1.0)/2));
-            pBBTmp->y = (int)(points[1][0].y - ((pBB->h * 1.0)/2));
+                    pBBTmp->x = (int)(points[1][idxIn].x - ((pBB->w * 1.0)/2));
+                    pBBTmp->y = (int)(points[1][idxIn].y - ((pBB->h * 1.0)/2));
 #endif
-            pBBTmp->pcClassName = (char*)malloc(strlen(pBB->pcClassName) + 1);
-            strcpy(pBBTmp->pcClassName, pBB->pcClassName);
-            pBBTmp->fCurrentFrameTimeStamp = pFTarg->fCurrentFrameTimeStamp;
-            pBBTmp->pNext = pOpticalFlowOutBBs;
-            pOpticalFlowOutBBs = pBBTmp;
+                    pBBTmp->fCurrentFrameTimeStamp = pFTarg->fCurrentFrameTimeStamp;
+                    pBBTmp->pNext = pOpticalFlowOutBBs;
+                    pOpticalFlowOutBBs = pBBTmp;
+                }
+                pTrackerBBs[idxIn].pBBTOrig = pBB;
+                idxIn++;
+                pBB = pBB->pNext;
             }
-            pTrackerBBs[idxIn].pBBTOrig = pBB;
-            idxIn++;
-            pBB = pBB->pNext;
         }
 #endif
 
 
 #ifdef USE_CV_TRACKING
-        bool ret;
-        pBB = apBoundingBoxesIn;
         tAnnInfo* pTrackerOutBBs = NULL;
+        tTrackJob* pJobs = new tTrackJob[nInBBs];
+        pTable->nGeneration++;
+        pBB = apBoundingBoxesIn;
         idxIn = 0;
         while(pBB)
+        {
+            prepare_track_job(pTable, &pJobs[idxIn], pBB, pFBase);
+            pTrackerBBs[idxIn].pBBTOrig = pBB;
+            pBB = pBB->pNext;
+            idxIn++;
+        }
+
+        run_track_jobs(pJobs, nInBBs, imgBaseM, imgTargM);
+
+        /** merge in slot order so the output does not depend on worker scheduling */
+        for(idxIn = 0; idxIn < nInBBs; idxIn++)
         {
             tAnnInfo* pBBTmp;
-            Ptr<Tracker> tracker = createTrackerByName(trackingAlg);
-            if(!tracker)
+            tTrackJob* pJob = &pJobs[idxIn];
+            pBB = pJob->pBB;
+            if(!pJob->pTrack)
                 continue;
-            ret = tracker->init(imgBaseM, Rect2d(pBB->x, pBB->y, pBB->w, pBB->h));
-            LOGV("initialized with %d %d %d %d ret=%d\n", pBB->x, pBB->y, pBB->w, pBB->h, ret);
-            if(ret)
+            if(pJob->bTracked)
             {
-                Rect2d object;
-                //update with target
-                for(int i = 0; i < MAX_TRACK_ITERATIONS; i++)
-                {
-                    ret = tracker->update(imgTargM, object);
-                    if(ret)
-                    {
-                        LOGV("update: (%f, %f) (%f, %f)\n", object.x, object.y, object.width, object.height);
-                    }
-                }
-                if(ret)
-                {
-                    LOGD("found\n");
-                    pBBTmp = &pTrackerBBs[idxIn].trackerBB;
-                    memcpy(pBBTmp, pBB, sizeof(tAnnInfo));
-                    pBBTmp->x = (int)(object.x);
-                    pBBTmp->y = (int)(object.y);
-                    pBBTmp->w = (int)(object.width);
-                    pBBTmp->h = (int)(object.height);
-                    pBBTmp->pcClassName = (char*)malloc(strlen(pBB->pcClassName) + 1);
-                    strcpy(pBBTmp->pcClassName, pBB->pcClassName);
-                    pBBTmp->fCurrentFrameTimeStamp = pFTarg->fCurrentFrameTimeStamp;
-                    pBBTmp->pNext = pTrackerOutBBs;
-                    pTrackerOutBBs = pBBTmp;
-                    pTrackerBBs[idxIn].trackerBB = *pBBTmp;
-                    LOGV("stored %d %d %d %d ret=%d\n", pBBTmp->x, pBBTmp->y, pBBTmp->w, pBBTmp->h, ret);
-                }
-                else
-                {
-                    LOGD("unable to track this object in tracker\n");
-                }
+                LOGD("found\n");
+                pJob->pTrack->lastBB = pJob->object;
+                pJob->pTrack->fLastTS = pFTarg->fCurrentFrameTimeStamp;
+                pBBTmp = &pTrackerBBs[idxIn].trackerBB;
+                memcpy(pBBTmp, pBB, sizeof(tAnnInfo));
+                pBBTmp->x = (int)(pJob->object.x);
+                pBBTmp->y = (int)(pJob->object.y);
+                pBBTmp->w = (int)(pJob->object.width);
+                pBBTmp->h = (int)(pJob->object.height);
+                pBBTmp->fCurrentFrameTimeStamp = pFTarg->fCurrentFrameTimeStamp;
+                pBBTmp->pNext = pTrackerOutBBs;
+                pTrackerOutBBs = pBBTmp;
+                LOGV("stored %d %d %d %d\n", pBBTmp->x, pBBTmp->y, pBBTmp->w, pBBTmp->h);
+            }
+            else
+            {
+                LOGD("unable to track this object in tracker\n");
+                /** lost; a fresh tracker is seeded if the object is detected again */
+                pTable->tracks.erase(pBB->nBBId);
             }
-            pTrackerBBs[idxIn].pBBTOrig = pBB;
-            //objects.push_back(Rect2d(pBB->x, pBB->y, pBB->w, pBB->h));
-            pBB = pBB->pNext;
-            idxIn++;
-            //delete tracker;
         }
+        delete[] pJobs;
+        retire_stale_tracks(pTable);
 #endif
 
         /** process BB's tracked in the detection list */
@@ -518,7 +774,8 @@ int track_bb_in_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase, tFrameInf
         assess_iou_trackerBBs_detectedBBs(pTrackerBBs,
                     nInBBs,
                     appBoundingBoxesInOut,
-                    pLanesInfo);
+                    pLanesInfo,
+                    pTable);
         //*appBoundingBoxesInOut = pTrackerOutBBs;
 #endif
 #if 0
@@ -536,24 +793,50 @@ int track_bb_in_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase, tFrameInf
 #endif
   
 #ifdef DISPLAY_RESULTS
+        gfTrackerFps = fps;
+        if(gbDisplayInTracker)
+            tracker_display_results(*appBoundingBoxesInOut, pFTarg, pLanesInfo);
+#endif
+    }
+
+
+
+    cleanup:
+
+    if(pTrackerBBs)
+        free(pTrackerBBs);
+    return ret;
+}
+
+void set_tracker_display_inline(int bInline)
+{
+    gbDisplayInTracker = bInline;
+}
+
+void tracker_display_results(tAnnInfo* pBBs, tFrameInfo* pFTarg, tLanesInfo* pLanesInfo)
+{
+#ifdef DISPLAY_RESULTS
+    Mat imgTargM;
+    String text;
+    char buffer [500];
+
+    if(!pFTarg)
+        return;
+    imgTargM = image_to_mat(pFTarg, false);
+
         // draw the processing speed
-        sprintf (buffer, "speed: %.0f fps", fps);
+        sprintf (buffer, "speed: %.0f fps", gfTrackerFps);
         text = buffer;
         putText(imgTargM, text, Point(20,20), FONT_HERSHEY_PLAIN, 1, Scalar(255,255,255));
 
         if(pLanesInfo)
         {
-                LOGV("DEBUGME\n");
             tLane* pL = pLanesInfo->pLanes;
-                LOGV("DEBUGME\n");
             while(pL)
             {
-                LOGV("DEBUGME\n");
                 memset(buffer, 0 , sizeof(buffer));
-                LOGV("DEBUGME %p\n", pL);
                 LOGV("%d %f %lld\n", pL->nLaneId, pL->fAvgStayDuration, pL->nTotalVehiclesSoFar);
                 snprintf(buffer, 499, "lane:%d; (%f,%lld)", pL->nLaneId, pL->fAvgStayDuration, pL->nTotalVehiclesSoFar);
-                LOGV("DEBUGME\n");
                 text = buffer;
                 putText(imgTargM, buffer, Point(pL->pVs->x, pL->pVs->y), FONT_HERSHEY_PLAIN, 1, Scalar(0, 0, 0));
                 
@@ -570,29 +853,17 @@ int track_bb_in_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase, tFrameInf
                 p2 = pL->pVs;
                 line(imgTargM,Point(p1->x, p1->y),Point(p2->x, p2->y),Scalar(0,0,0));
 
-
-                LOGV("DEBUGME\n");
                 pL = pL->pNext;
             }
-                LOGV("DEBUGME\n");
         }
   
-        display_results(imgTargM, *appBoundingBoxesInOut);
+        display_results(imgTargM, pBBs);
         // show image with the tracked object
         imshow("tracker",imgTargM);
   
         //quit on ESC button
         waitKey(1);
-#endif
-    }
-
-
-
-    cleanup:
-
-    if(pTrackerBBs)
-        free(pTrackerBBs);
-    return ret;
+#endif /**< DISPLAY_RESULTS */
 }
 
 int tracker_display_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase)
@@ -743,10 +1014,195 @@ void assess_iou_trackedBBs_detectedBBs(tAnnInfo* pTrackedBBs,
 }
 #endif
 
+void set_bb_association_algo(int nVideoId, tBBAssocAlgo eAlgo)
+{
+    LOGV("stream %d: BB association algo %d\n", nVideoId, eAlgo);
+    gTrackTables[nVideoId].eAssocAlgo = eAlgo;
+}
+
+/**
+ * minimum cost assignment (Hungarian method with potentials)
+ * @param pCost [IN] nRows x nCols cost matrix; row-major
+ * @param pnRowToCol [OUT] for each row, the assigned column or -1
+ * O(n^2 * m) for n = min(nRows, nCols), m = max(nRows, nCols)
+ */
+static void solve_assignment(const double* pCost, int nRows, int nCols, int* pnRowToCol)
+{
+    /** the method wants n <= m; work on the transpose otherwise */
+    const bool bTranspose = nRows > nCols;
+    const int n = bTranspose ? nCols : nRows;
+    const int m = bTranspose ? nRows : nCols;
+    std::vector<double> u(n + 1, 0.0), v(m + 1, 0.0), minv(m + 1);
+    std::vector<int> p(m + 1, 0), way(m + 1, 0);
+    std::vector<char> used(m + 1);
+
+    for(int r = 0; r < nRows; r++)
+        pnRowToCol[r] = -1;
+
+    /** 1-indexed; p[j] is the row (1..n) matched to column j, 0 when free */
+    for(int i = 1; i <= n; i++)
+    {
+        int j0 = 0;
+        p[0] = i;
+        std::fill(minv.begin(), minv.end(), DBL_MAX);
+        std::fill(used.begin(), used.end(), 0);
+        do
+        {
+            int i0 = p[j0], j1 = 0;
+            double delta = DBL_MAX;
+            used[j0] = 1;
+            for(int j = 1; j <= m; j++)
+            {
+                if(used[j])
+                    continue;
+                double c = bTranspose ? pCost[(j - 1) * nCols + (i0 - 1)] : pCost[(i0 - 1) * nCols + (j - 1)];
+                double cur = c - u[i0] - v[j];
+                if(cur < minv[j])
+                {
+                    minv[j] = cur;
+                    way[j] = j0;
+                }
+                if(minv[j] < delta)
+                {
+                    delta = minv[j];
+                    j1 = j;
+                }
+            }
+            for(int j = 0; j <= m; j++)
+            {
+                if(used[j])
+                {
+                    u[p[j]] += delta;
+                    v[j] -= delta;
+                }
+                else
+                    minv[j] -= delta;
+            }
+            j0 = j1;
+        } while(p[j0] != 0);
+        /** augment along the alternating path */
+        do
+        {
+            int j1 = way[j0];
+            p[j0] = p[j1];
+            j0 = j1;
+        } while(j0);
+    }
+
+    for(int j = 1; j <= m; j++)
+    {
+        if(!p[j])
+            continue;
+        if(bTranspose)
+            pnRowToCol[j - 1] = p[j] - 1;
+        else
+            pnRowToCol[p[j] - 1] = j - 1;
+    }
+}
+
+/** IoU of one BB against every BB in the set; branch-free over the SoA arrays */
+static void iou_with_bbset(const tAnnInfo* pBB, const tBBSet* pSet, double* pfIoU)
+{
+    const double fA = (double)pBB->w * pBB->h;
+    for(int j = 0; j < pSet->n; j++)
+    {
+        double wI = (double)(MIN(pBB->x + pBB->w, pSet->x[j] + pSet->w[j]) - MAX(pBB->x, pSet->x[j]));
+        double hI = (double)(MIN(pBB->y + pBB->h, pSet->y[j] + pSet->h[j]) - MAX(pBB->y, pSet->y[j]));
+        double fInter = MAX(wI, 0.0) * MAX(hI, 0.0);
+        double fUnion = fA + (double)pSet->w[j] * pSet->h[j] - fInter;
+        pfIoU[j] = fUnion > 0.0 ? fInter / fUnion : 0.0;
+    }
+}
+
+/**
+ * affinity of a tracker slot with every detected BB in [0, 1]; 0 when the pair fails the gate
+ * the median-flow BB is gated on IoU, the optical flow (a center point) on isWithinBB()
+ * and then scored by the IoU of the source-sized BB re-centered on the flow point;
+ * FORCE_OFF_OPTICAL_FLOW_RESULTS drops the optical flow term as in the greedy path
+ */
+static void assoc_affinity(tTrackerBBInfo* pTrackerBB, const tBBSet* pDetected, double* pfAffinity, double* pfScratch)
+{
+    for(int j = 0; j < pDetected->n; j++)
+        pfAffinity[j] = 0.0;
+
+    if(pTrackerBB->trackerBB.pcClassName)
+    {
+        iou_with_bbset(&pTrackerBB->trackerBB, pDetected, pfScratch);
+        for(int j = 0; j < pDetected->n; j++)
+            pfAffinity[j] = pfScratch[j] > GOOD_IOU_THRESHOLD ? pfScratch[j] : 0.0;
+    }
+#ifndef FORCE_OFF_OPTICAL_FLOW_RESULTS
+    if(pTrackerBB->opticalFlowBB.pcClassName)
+    {
+        tAnnInfo flowBB = pTrackerBB->opticalFlowBB;
+        flowBB.x -= flowBB.w/2;
+        flowBB.y -= flowBB.h/2;
+        iou_with_bbset(&flowBB, pDetected, pfScratch);
+        for(int j = 0; j < pDetected->n; j++)
+        {
+            if(isWithinBB(&pTrackerBB->opticalFlowBB, pDetected->ppBB[j]))
+            {
+                /** within the gate, so never less likely than a bare IoU match */
+                pfAffinity[j] = MAX(pfAffinity[j], MAX(pfScratch[j], GOOD_IOU_THRESHOLD));
+            }
+        }
+    }
+#endif /**< FORCE_OFF_OPTICAL_FLOW_RESULTS */
+
+#ifndef CLASS_AGNOSTIC_BB_TRACKING
+    for(int j = 0; j < pDetected->n; j++)
+    {
+        if(pDetected->nClassId[j] != pTrackerBB->pBBTOrig->nClassId)
+            pfAffinity[j] = 0.0;
+    }
+#endif /**< CLASS_AGNOSTIC_BB_TRACKING */
+}
+
+/** one-to-one association of tracker slots and detected BBs solved on a dense cost matrix */
+static void assign_trackerBBs_to_detectedBBs(tTrackerBBInfo* pTrackerBBs,
+                const int nTrackerInSlots,
+                tAnnInfo* pDetectedBBs,
+                tTrackTable* pTable)
+{
+    tBBSet& detected = pTable->detected;
+    tAnnInfo* pBBD;
+
+    bbset_from_list(&detected, pDetectedBBs);
+    const int nDetected = detected.n;
+    if(!nTrackerInSlots || !nDetected)
+        return;
+
+    std::vector<double> cost((size_t)nTrackerInSlots * nDetected);
+    std::vector<double> affinity(nDetected), scratch(nDetected);
+    std::vector<int> assignment(nTrackerInSlots);
+    for(int i = 0; i < nTrackerInSlots; i++)
+    {
+        assoc_affinity(&pTrackerBBs[i], &detected, &affinity[0], &scratch[0]);
+        for(int j = 0; j < nDetected; j++)
+            cost[(size_t)i * nDetected + j] = affinity[j] > 0.0 ? 1.0 - affinity[j] : ASSOC_NO_MATCH_COST;
+    }
+
+    solve_assignment(&cost[0], nTrackerInSlots, nDetected, &assignment[0]);
+
+    for(int i = 0; i < nTrackerInSlots; i++)
+    {
+        int j = assignment[i];
+        if(j < 0 || cost[(size_t)i * nDetected + j] >= ASSOC_NO_MATCH_COST)
+            continue;
+        pBBD = detected.ppBB[j];
+        pBBD->nBBId = pTrackerBBs[i].pBBTOrig->nBBId;
+        pBBD->fIoU = 1.0 - cost[(size_t)i * nDetected + j];
+        pBBD->bBBIDAssigned = pTrackerBBs[i].bInDetectionList = 1;
+        pBBD->fDirection = pBBD->x - pTrackerBBs[i].pBBTOrig->x > 0 ? 'L'  : 'R';
+        LOGV("slot %d -> BBID=%d affinity=%f\n", i, pBBD->nBBId, pBBD->fIoU);
+    }
+}
+
 void assess_iou_trackerBBs_detectedBBs(tTrackerBBInfo* pTrackerBBs,
                 const int nTrackerInSlots,
                 tAnnInfo** ppDetectedBBs,
-                tLanesInfo* pLanesInfo)
+                tLanesInfo* pLanesInfo,
+                tTrackTable* pTable)
 {
     tAnnInfo* pTrackedBBs = NULL;
     if(!pTrackerBBs || !ppDetectedBBs)
@@ -766,6 +1222,12 @@ void assess_iou_trackerBBs_detectedBBs(tTrackerBBInfo* pTrackerBBs,
         pBBD = pBBD->pNext;
     }
 
+    if(pTable->eAssocAlgo == BB_ASSOC_HUNGARIAN)
+    {
+        assign_trackerBBs_to_detectedBBs(pTrackerBBs, nTrackerInSlots, pDetectedBBs, pTable);
+    }
+    else
+    {
 #ifdef MULTI_ALGORITHMIC_APPROACH
     /** for all tracked BBs, find the corresponding BB in the detection result by
      * matching the IoU between tracked BBs and detected BBs 
@@ -816,7 +1278,7 @@ void assess_iou_trackerBBs_detectedBBs(tTrackerBBInfo* pTrackerBBs,
                         tmpT.y -= (tmpT.h/2);
                         ppBBT[k]->fIoU = find_iou(&tmpT, pBBD);
                         /** if this BB did not move much from previous, use median flow */
-                        tAnnInfo* pBBTmp = getBBById(pCopyDetectedBBs, ppBBT[k]->nBBId);
+                        tAnnInfo* pBBTmp = getBBById(pTable->pCopyDetectedBBs, ppBBT[k]->nBBId);
                         double disp = 0;
                         if(pBBTmp && ((disp = displacement_btw_BBs(&tmpT, pBBTmp)) == 0.0)) /**< use median flow */
                         {
@@ -960,6 +1422,7 @@ void assess_iou_trackerBBs_detectedBBs(tTrackerBBInfo* pTrackerBBs,
     }
 
 #endif
+    }
 
 #if 0
     for(int i = 0; i < nTrackerInSlots; i++)
@@ -982,7 +1445,7 @@ void assess_iou_trackerBBs_detectedBBs(tTrackerBBInfo* pTrackerBBs,
 #endif
             if(pBBTmp1)
             {
-                if(check_if_new_BB_acceptable(pBBTmp1, pCopyDetectedBBs))
+                if(check_if_new_BB_acceptable(pBBTmp1, pTable->pCopyDetectedBBs))
                 {
                 tAnnInfo* pBBTmp;
                 
@@ -1012,10 +1475,10 @@ void assess_iou_trackerBBs_detectedBBs(tTrackerBBInfo* pTrackerBBs,
     *ppDetectedBBs = pDetectedBBs;
 #endif
 
-    collect_analysis(*ppDetectedBBs, pCopyDetectedBBs, pLanesInfo);
+    collect_analysis(*ppDetectedBBs, pTable->pCopyDetectedBBs, pLanesInfo);
 
-    free_BBs(pCopyDetectedBBs);
-    pCopyDetectedBBs = make_copy_of_current_set(*ppDetectedBBs);
+    free_BBs(pTable->pCopyDetectedBBs);
+    pTable->pCopyDetectedBBs = make_copy_of_current_set(*ppDetectedBBs);
 
 
     
@@ -1203,6 +1666,7 @@ void mouseHandler(int event,int x,int y,int flags,void* userdata)
       polygon->pNext = poly->pLanesInfo->pLanes;
       poly->pLanesInfo->pLanes = polygon;
       poly->pLanesInfo->nLanes++;
+      invalidate_lane_index(poly->pLanesInfo);
       poly->vertices.clear();
 
       // Mask is black with white where our ROI is
@@ -1355,12 +1819,6 @@ bool isInside(tLane* pLane, tVertex p)
     return count&1;  // Same as (count%2 == 1)
 }
 
-int isWithinLane(tLane* pLane, tVertex* pVertex)
-{
-    if(!pLane || !pVertex)
-        return 0;
-    return isInside(pLane, *pVertex);
-}
 
 int isWithinBB(tAnnInfo* pBBP, tAnnInfo* pBBD)
 {
@@ -1394,18 +1852,83 @@ int isViolation(int from, int to)
 }
 
 
+static inline unsigned int hash_bb_id(int nBBId)
+{
+    /** Knuth's multiplicative hash; nBBIds are mostly consecutive */
+    return (unsigned int)nBBId * 2654435761u;
+}
+
+void build_bb_id_index(tBBIdIndex* pIndex, tAnnInfo* pBBs)
+{
+    int nBBs = 0;
+    tAnnInfo* pBB = pBBs;
+
+    if(!pIndex)
+        return;
+
+    while(pBB)
+    {
+        nBBs++;
+        pBB = pBB->pNext;
+    }
+    /** keep the load factor under 0.5 */
+    pIndex->nSlots = 16;
+    while(pIndex->nSlots < nBBs * 2)
+        pIndex->nSlots <<= 1;
+    pIndex->ppSlots = (tAnnInfo**)calloc(pIndex->nSlots, sizeof(tAnnInfo*));
+
+    pBB = pBBs;
+    while(pBB)
+    {
+        unsigned int i = hash_bb_id(pBB->nBBId) & (pIndex->nSlots - 1);
+        while(pIndex->ppSlots[i] && pIndex->ppSlots[i]->nBBId != pBB->nBBId)
+            i = (i + 1) & (pIndex->nSlots - 1);
+        /** the first BB in list order wins, as in getBBById() */
+        if(!pIndex->ppSlots[i])
+            pIndex->ppSlots[i] = pBB;
+        pBB = pBB->pNext;
+    }
+}
+
+tAnnInfo* find_bb_by_id(tBBIdIndex* pIndex, int nBBId)
+{
+    if(!pIndex || !pIndex->ppSlots)
+        return NULL;
+
+    unsigned int i = hash_bb_id(nBBId) & (pIndex->nSlots - 1);
+    while(pIndex->ppSlots[i])
+    {
+        if(pIndex->ppSlots[i]->nBBId == nBBId)
+            return pIndex->ppSlots[i];
+        i = (i + 1) & (pIndex->nSlots - 1);
+    }
+
+    return NULL;
+}
+
+void free_bb_id_index(tBBIdIndex* pIndex)
+{
+    if(!pIndex)
+        return;
+    free(pIndex->ppSlots);
+    pIndex->ppSlots = NULL;
+    pIndex->nSlots = 0;
+}
+
 void collect_analysis(tAnnInfo* pCurrFrameBBs, tAnnInfo* pPrevFrameBBs, tLanesInfo* pLanesInfo)
 {
     tAnnInfo* pBBNode = NULL;
     tAnnInfo* pCurrBB = NULL;
+    tBBIdIndex currFrameIndex;
     if(!pCurrFrameBBs || !pPrevFrameBBs || !pLanesInfo)
         return;
 
+    build_bb_id_index(&currFrameIndex, pCurrFrameBBs);
     pBBNode = pPrevFrameBBs;
     while(pBBNode)
     {
 
-        if((pCurrBB = getBBById(pCurrFrameBBs, pBBNode->nBBId)))
+        if((pCurrBB = find_bb_by_id(&currFrameIndex, pBBNode->nBBId)))
         {
             /** an object is tracked in the curr frame;
              * avg-wait-time
@@ -1479,28 +2002,184 @@ void collect_analysis(tAnnInfo* pCurrFrameBBs, tAnnInfo* pPrevFrameBBs, tLanesIn
         pBBNode = pBBNode->pNext;
     }
 
+    free_bb_id_index(&currFrameIndex);
     return;
 }
 
-tLane* laneWithThisBB(tLanesInfo* pLanesInfo, tAnnInfo* pBBNode)
+/** lane-ID raster at the processing resolution; each pixel holds the
+ * (1-based) position in pLanes of the lane it belongs to, or 0 for none.
+ * Where lanes overlap, the lane earlier in pLanes wins - the same priority
+ * the list walk in laneWithThisBB() always had */
+#define MAX_RASTER_LANES 255
+
+typedef struct
+{
+    int w;
+    int h;
+    int nLanes; /**< tLanesInfo::nLanes at build time; lanes may be added by getLaneInfo() */
+    std::vector<uint8_t> ids;
+    std::vector<tLane*> lanes; /**< raster value - 1 -> lane */
+}tLaneRaster;
+
+void set_lanes_resolution(tLanesInfo* pLanesInfo, int w, int h)
+{
+    if(!pLanesInfo)
+        return;
+    /** the raster is rebuilt on the next lookup */
+    pLanesInfo->nFrameW = w;
+    pLanesInfo->nFrameH = h;
+}
+
+static tLaneRaster* get_lane_raster(tLanesInfo* pLanesInfo)
 {
+    tLaneRaster* pRaster = (tLaneRaster*)pLanesInfo->pLaneIndex;
+    int w = pLanesInfo->nFrameW;
+    int h = pLanesInfo->nFrameH;
     tLane* pL;
 
-    if(!pLanesInfo || !pBBNode)
-        return NULL;
+    if(!w || !h)
+    {
+        /** resolution not known; cover every lane */
+        w = h = 0;
+        for(pL = pLanesInfo->pLanes; pL; pL = pL->pNext)
+        {
+            for(tVertex* pV = pL->pVs; pV; pV = pV->pNext)
+            {
+                w = MAX(w, pV->x + 1);
+                h = MAX(h, pV->y + 1);
+            }
+        }
+    }
+
+    if(pRaster && pRaster->nLanes == pLanesInfo->nLanes
+       && pRaster->w == w && pRaster->h == h)
+        return pRaster;
+
+    delete pRaster;
+    pRaster = new tLaneRaster;
+    pRaster->w = w;
+    pRaster->h = h;
+    pRaster->nLanes = pLanesInfo->nLanes;
+    pRaster->ids.assign((size_t)w * h, INVALID_LANE_ID);
 
-    pL = pLanesInfo->pLanes;
-    while(pL)
+    for(pL = pLanesInfo->pLanes; pL && pRaster->lanes.size() < MAX_RASTER_LANES; pL = pL->pNext)
     {
-        tVertex nTmp = {0};
-        nTmp.x = pBBNode->x;
-        nTmp.y = pBBNode->y;
-        nTmp.x += (pBBNode->w/2);
-        nTmp.y += (int)((pBBNode->h * 3.0) / 4);
-        if(isWithinLane(pL, &nTmp))
+        int xMin = INT_MAX, yMin = INT_MAX, xMax = INT_MIN, yMax = INT_MIN;
+        pRaster->lanes.push_back(pL);
+        const uint8_t id = (uint8_t)pRaster->lanes.size();
+        for(tVertex* pV = pL->pVs; pV; pV = pV->pNext)
+        {
+            xMin = MIN(xMin, pV->x);
+            yMin = MIN(yMin, pV->y);
+            xMax = MAX(xMax, pV->x);
+            yMax = MAX(yMax, pV->y);
+        }
+        /** exact same test as the list walk, once per pixel of the lane's bounding box */
+        for(int y = MAX(yMin, 0); y <= MIN(yMax, h - 1); y++)
+        {
+            uint8_t* pRow = &pRaster->ids[(size_t)y * w];
+            for(int x = MAX(xMin, 0); x <= MIN(xMax, w - 1); x++)
+            {
+                tVertex p = {x, y, NULL};
+                if(pRow[x] == INVALID_LANE_ID && isInside(pL, p))
+                    pRow[x] = id;
+            }
+        }
+    }
+    if(pL)
+        LOGE("only the first %d lanes are rasterized\n", MAX_RASTER_LANES);
+    LOGV("lane raster %dx%d for %d lanes\n", w, h, pRaster->nLanes);
+
+    pLanesInfo->pLaneIndex = pRaster;
+    return pRaster;
+}
+
+void invalidate_lane_index(tLanesInfo* pLanesInfo)
+{
+    if(!pLanesInfo)
+        return;
+    delete (tLaneRaster*)pLanesInfo->pLaneIndex;
+    pLanesInfo->pLaneIndex = NULL;
+}
+
+/** first lane in pLanes holding point p; one raster read unless p is off the raster */
+static tLane* lane_at_point(tLanesInfo* pLanesInfo, tVertex p)
+{
+    tLaneRaster* pRaster = get_lane_raster(pLanesInfo);
+    tLane* pL;
+
+    if(p.x >= 0 && p.y >= 0 && p.x < pRaster->w && p.y < pRaster->h
+       && pRaster->nLanes <= MAX_RASTER_LANES)
+    {
+        uint8_t id = pRaster->ids[(size_t)p.y * pRaster->w + p.x];
+        return id == INVALID_LANE_ID ? NULL : pRaster->lanes[id - 1];
+    }
+
+    /** off the raster (a lane drawn past the frame edge) */
+    for(pL = pLanesInfo->pLanes; pL; pL = pL->pNext)
+    {
+        if(isInside(pL, p))
             return pL;
-        pL = pL->pNext;
     }
 
     return NULL;
 }
+
+int isWithinLane(tLanesInfo* pLanesInfo, tLane* pLane, tVertex* pVertex)
+{
+    tLane* pL;
+    if(!pLanesInfo || !pLane || !pVertex)
+        return 0;
+    pL = lane_at_point(pLanesInfo, *pVertex);
+    if(pL == pLane)
+        return 1;
+    /** the raster keeps one lane per pixel; pLane may still hold p where it overlaps an earlier lane */
+    return pL ? isInside(pLane, *pVertex) : 0;
+}
+
+tLane* laneWithThisBB(tLanesInfo* pLanesInfo, tAnnInfo* pBBNode)
+{
+    if(!pLanesInfo || !pBBNode)
+        return NULL;
+
+    tVertex nTmp = {0};
+    nTmp.x = pBBNode->x;
+    nTmp.y = pBBNode->y;
+    nTmp.x += (pBBNode->w/2);
+    nTmp.y += (int)((pBBNode->h * 3.0) / 4);
+
+    return lane_at_point(pLanesInfo, nTmp);
+}
+
+void free_lanes_info(tLanesInfo* pLanesInfo)
+{
+    if(!pLanesInfo)
+        return;
+    invalidate_lane_index(pLanesInfo);
+    while(pLanesInfo->pLanes)
+    {
+        tLane* pL = pLanesInfo->pLanes;
+        pLanesInfo->pLanes = pL->pNext;
+        while(pL->pVs)
+        {
+            tVertex* pV = pL->pVs;
+            pL->pVs = pV->pNext;
+            free(pV);
+        }
+        free(pL->pcRoute);
+        free(pL->pnVehicleCount);
+        free(pL);
+    }
+    if(pLanesInfo->ppRouteTrafficInfo)
+    {
+        for(int j = 0; j < pLanesInfo->nLanes+1; j++)
+        {
+            for(int k = 0; pLanesInfo->ppRouteTrafficInfo[j] && k < pLanesInfo->nLanes+1; k++)
+                free(pLanesInfo->ppRouteTrafficInfo[j][k].pnVehicleCount);
+            free(pLanesInfo->ppRouteTrafficInfo[j]);
+        }
+        free(pLanesInfo->ppRouteTrafficInfo);
+    }
+    /** names are the detector's */
+    free(pLanesInfo);
+}
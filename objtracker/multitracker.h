@@ -11,6 +11,13 @@ extern "C" {
 
 #define INVALID_LANE_ID (0)
 
+/** algorithms to associate tracked BBs with the BBs detected on the target frame */
+typedef enum
+{
+    BB_ASSOC_GREEDY = 0, /**< first/best match while walking the BB lists */
+    BB_ASSOC_HUNGARIAN, /**< optimal one-to-one assignment on a dense IoU cost matrix */
+}tBBAssocAlgo;
+
 typedef struct Vertexx tVertex;
 typedef struct LaneX tLane;
 struct Vertexx
@@ -48,8 +55,18 @@ typedef struct
    tRouteTrafficInfo** ppRouteTrafficInfo; /**< 2D array; nLanes X nLanes */
    char** names;
    int nTypes;
+   void* pLaneIndex; /**< lane-ID raster over pLanes; built on first lookup by laneWithThisBB(), dropped by invalidate_lane_index() */
+   int nFrameW; /**< processing resolution of the raster; 0 to cover the lanes' extent */
+   int nFrameH;
 }tLanesInfo;
 
+/** BB lookup by nBBId over one list of BBs; open addressing, built once per frame */
+typedef struct
+{
+    tAnnInfo** ppSlots;
+    int nSlots; /**< power of 2 */
+}tBBIdIndex;
+
 inline tLane* getLaneById(tLanesInfo* pLanesInfo, int nLaneId)
 {
     if(!pLanesInfo)
@@ -68,6 +85,17 @@ inline tLane* getLaneById(tLanesInfo* pLanesInfo, int nLaneId)
 
 int track_bb_in_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase, tFrameInfo* pFTarg, tAnnInfo** appBoundingBoxesOut, tLanesInfo* pLanesInfo);
 int tracker_display_frame(tAnnInfo* apBoundingBoxesIn, tFrameInfo* pFBase);
+/** draw pBBs and the lanes on pFTarg and show it in the "tracker" window; a no-op without DISPLAY_RESULTS */
+void tracker_display_results(tAnnInfo* pBBs, tFrameInfo* pFTarg, tLanesInfo* pLanesInfo);
+/**
+ * 1 (default): track_bb_in_frame() shows its results itself
+ * 0: it does not, and the caller shows them with tracker_display_results(); for callers that track
+ * off the thread which owns the HighGUI windows
+ */
+void set_tracker_display_inline(int bInline);
+
+/** select the tracker to detection association algorithm of the stream nVideoId; can be changed between frames */
+void set_bb_association_algo(int nVideoId, tBBAssocAlgo eAlgo);
 
 /**
  * This function take 2 BBs list
@@ -102,7 +130,22 @@ inline void display_lanes_info(tLanesInfo* pLanesInfo)
     }
 }
 
-int isWithinLane(tLane* pLane, tVertex* pPoint);
+/** is pPoint in pLane; read off pLanesInfo's lane raster */
+int isWithinLane(tLanesInfo* pLanesInfo, tLane* pLane, tVertex* pPoint);
+/** lane the BB's ground point lies in; one raster read per BB */
+tLane* laneWithThisBB(tLanesInfo* pLanesInfo, tAnnInfo* pBBNode);
+/** resolution of the frames the lane vertices are in; the lane raster is rebuilt when it changes */
+void set_lanes_resolution(tLanesInfo* pLanesInfo, int w, int h);
+/** drop the lane raster; call after adding lanes to pLanesInfo or moving a lane's vertices */
+void invalidate_lane_index(tLanesInfo* pLanesInfo);
+/** free pLanesInfo with its lanes, counters and raster; names are not freed */
+void free_lanes_info(tLanesInfo* pLanesInfo);
+
+/** the index keeps pointers into pBBs; rebuild it when the list changes */
+void build_bb_id_index(tBBIdIndex* pIndex, tAnnInfo* pBBs);
+/** same result as getBBById(): the first BB in list order with nBBId */
+tAnnInfo* find_bb_by_id(tBBIdIndex* pIndex, int nBBId);
+void free_bb_id_index(tBBIdIndex* pIndex);
 
 
 #ifdef __cplusplus